@@ -0,0 +1,580 @@
+
+#include <modbus/modbus.h>		// error codes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+
+#include "libmbc.h"
+
+/*
+libmbc - see libmbc.h
+
+Frame handling and decoding used by mbc, plus a blocking transport for
+callers without an event loop of their own.
+*/
+
+const mbc_reg_t mbc_registers[] = {
+	  { 0x0010,	2,	1,	 0,	"V",		"Voltage L1" }
+	, { 0x0012,	2,	1,	 0,	"V",		"Voltage L2" }
+	, { 0x0014,	2,	1,	 0,	"V",		"Voltage L3" }
+	, { 0x004E,	2,	1,	 0,	"Hz",		"Frequency" }		// !
+	, { 0x0050,	2,	2,	-2,	"A",		"Current L1" }
+	, { 0x0052,	2,	2,	-2,	"A",		"Current L2" }
+	, { 0x0054,	2,	2,	-2,	"A",		"Current L3" }
+	, { 0x0056,	2,	2,	-2,	"A",		"Current N" }
+	, { 0x0090,	2,	2,	-4,	"kW",		"Power L1" }
+	, { 0x0092,	2,	2,	-4,	"kW",		"Power L2" }
+	, { 0x0094,	2,	2,	-4,	"kW",		"Power L3" }
+	, { 0x0096,	2,	2,	-4,	"kW",		"Power Total" }
+	, { 0x00D0,	2,	2,	-4,	"kVA",		"Apparent Power L1" }
+	, { 0x00D2,	2,	2,	-4,	"kVA",		"Apparent Power L2" }
+	, { 0x00D4,	2,	2,	-4,	"kVA",		"Apparent Power L3" }
+	, { 0x00D6,	2,	2,	-4,	"kVA",		"Apparent Power Total" }
+	, { 0x0110,	2,	2,	-2,	"kvar",		"Reactive Power L1" }
+	, { 0x0112,	2,	2,	-2,	"kvar",		"Reactive Power L2" }
+	, { 0x0114,	2,	2,	-2,	"kvar",		"Reactive Power L3" }
+	, { 0x0116,	2,	2,	-2,	"kvar",		"Reactive Power Total" }
+	, { 0x0150,	2,	2,	-3,	"cos phi",	"Power Factor L1" }
+	, { 0x0152,	2,	2,	-3,	"cos phi",	"Power Factor L2" }
+	, { 0x0154,	2,	2,	-3,	"cos phi",	"Power Factor L3" }
+	, { 0x0156,	2,	2,	-3,	"cos phi",	"Power Factor Total" }
+	, { 0x0160,	2,	2,	-2,	"kWh",		"Import Energy" }
+	, { 0x0166,	2,	2,	-2,	"kWh",		"Export Energy" }
+	, { 0x07D0,	2,	2,	-2,	"kWh",		"Import Energy Rate 1" }
+	, { 0x07D2,	2,	2,	-2,	"kWh",		"Import Energy Rate 2" }
+	, { 0x07D4,	2,	2,	-2,	"kWh",		"Import Energy Rate 3" }
+	, { 0x07D6,	2,	2,	-2,	"kWh",		"Import Energy Rate 4" }
+	, { 0x08D0,	2,	2,	-2,	"kWh",		"Export Energy Rate 1" }
+	, { 0x08D2,	2,	2,	-2,	"kWh",		"Export Energy Rate 2" }
+	, { 0x08D4,	2,	2,	-2,	"kWh",		"Export Energy Rate 3" }
+	, { 0x08D6,	2,	2,	-2,	"kWh",		"Export Energy Rate 4" }
+	, { 0xF000,	4,	3,	 0,	"",			"Time/Date" }
+	, { 0xF111,	10,	4,	-2,	"kWh",		"Last 1 month positive Energy" }
+	, { 0xF121,	10,	4,	-2,	"kWh",		"Last 2 month positive Energy" }
+	, { 0xF131,	10,	4,	-2,	"kWh",		"Last 3 month positive Energy" }
+	, { 0xF141,	10,	4,	-2,	"kWh",		"Last 4 month positive Energy" }
+	, { 0xF151,	10,	4,	-2,	"kWh",		"Last 5 month positive Energy" }
+	, { 0xF161,	10,	4,	-2,	"kWh",		"Last 6 month positive Energy" }
+	, { 0xF171,	10,	4,	-2,	"kWh",		"Last 7 month positive Energy" }
+	, { 0xF181,	10,	4,	-2,	"kWh",		"Last 8 month positive Energy" }
+	, { 0xF191,	10,	4,	-2,	"kWh",		"Last 9 month positive Energy" }
+	, { 0xF1A1,	10,	4,	-2,	"kWh",		"Last 10 month positive Energy" }
+	, { 0xF1B1,	10,	4,	-2,	"kWh",		"Last 11 month positive Energy" }
+	, { 0xF1C1,	10,	4,	-2,	"kWh",		"Last 12 month positive Energy" }
+	, { 0xF211,	10,	4,	-2,	"kWh",		"Last 1 month reverse Energy" }
+	, { 0xF221,	10,	4,	-2,	"kWh",		"Last 2 month reverse Energy" }
+	, { 0xF231,	10,	4,	-2,	"kWh",		"Last 3 month reverse Energy" }
+	, { 0xF241,	10,	4,	-2,	"kWh",		"Last 4 month reverse Energy" }
+	, { 0xF251,	10,	4,	-2,	"kWh",		"Last 5 month reverse Energy" }
+	, { 0xF261,	10,	4,	-2,	"kWh",		"Last 6 month reverse Energy" }
+	, { 0xF271,	10,	4,	-2,	"kWh",		"Last 7 month reverse Energy" }
+	, { 0xF281,	10,	4,	-2,	"kWh",		"Last 8 month reverse Energy" }
+	, { 0xF291,	10,	4,	-2,	"kWh",		"Last 9 month reverse Energy" }
+	, { 0xF2A1,	10,	4,	-2,	"kWh",		"Last 10 month reverse Energy" }
+	, { 0xF2B1,	10,	4,	-2,	"kWh",		"Last 11 month reverse Energy" }
+	, { 0xF2C1,	10,	4,	-2,	"kWh",		"Last 12 month reverse Energy" }
+	, { 0xF311,	10,	4,	-4,	"kW",		"Last 1 month positive max Demand" }
+	, { 0xF321,	10,	4,	-4,	"kW",		"Last 2 month positive max Demand" }
+	, { 0xF331,	10,	4,	-4,	"kW",		"Last 3 month positive max Demand" }
+	, { 0xF341,	10,	4,	-4,	"kW",		"Last 4 month positive max Demand" }
+	, { 0xF351,	10,	4,	-4,	"kW",		"Last 5 month positive max Demand" }
+	, { 0xF361,	10,	4,	-4,	"kW",		"Last 6 month positive max Demand" }
+	, { 0xF371,	10,	4,	-4,	"kW",		"Last 7 month positive max Demand" }
+	, { 0xF381,	10,	4,	-4,	"kW",		"Last 8 month positive max Demand" }
+	, { 0xF391,	10,	4,	-4,	"kW",		"Last 9 month positive max Demand" }
+	, { 0xF3A1,	10,	4,	-4,	"kW",		"Last 10 month positive max Demand" }
+	, { 0xF3B1,	10,	4,	-4,	"kW",		"Last 11 month positive max Demand" }
+	, { 0xF3C1,	10,	4,	-4,	"kW",		"Last 12 month positive max Demand" }
+	, { 0xF411,	10,	4,	-4,	"kW",		"Last 1 month reverse max Demand" }
+	, { 0xF421,	10,	4,	-4,	"kW",		"Last 2 month reverse max Demand" }
+	, { 0xF431,	10,	4,	-4,	"kW",		"Last 3 month reverse max Demand" }
+	, { 0xF441,	10,	4,	-4,	"kW",		"Last 4 month reverse max Demand" }
+	, { 0xF451,	10,	4,	-4,	"kW",		"Last 5 month reverse max Demand" }
+	, { 0xF461,	10,	4,	-4,	"kW",		"Last 6 month reverse max Demand" }
+	, { 0xF471,	10,	4,	-4,	"kW",		"Last 7 month reverse max Demand" }
+	, { 0xF481,	10,	4,	-4,	"kW",		"Last 8 month reverse max Demand" }
+	, { 0xF491,	10,	4,	-4,	"kW",		"Last 9 month reverse max Demand" }
+	, { 0xF4A1,	10,	4,	-4,	"kW",		"Last 10 month reverse max Demand" }
+	, { 0xF4B1,	10,	4,	-4,	"kW",		"Last 11 month reverse max Demand" }
+	, { 0xF4C1,	10,	4,	-4,	"kW",		"Last 12 month reverse max Demand" }
+		
+	, { 0xF500,	 2,	5, 	 0,	"",			"Intervals & Times" }
+	, { 0xF600,	 0,	6,	 0,	"", 		"!!! Meter Number" }	// ! Not working?
+	, { 0xF700,	15,	7,	 0,	"",			"Tariff" }
+		
+	, { 0xF800,	 2,	1,	 0,	"Baud",		"!!!Baudrate" }	// ! Baudrate write only?
+			
+	, { 0xFA01,	10,	4,	-4,	"kW",		"Current month positive max Demand" }
+	, { 0xFB01,	10,	4,	-4,	"kW",		"Current month reverse max Demand" }
+		
+	, { 0x0000,	0,	0,	 0,	"",			"" }
+};
+
+/**********************************************************************
+	Modbus RTU CRC
+**********************************************************************/
+uint16_t mbc_crc16(const uint8_t *buf, int len)
+{
+	uint16_t crc = 0xFFFF;
+
+	while (len--)
+	{
+		crc ^= *buf++;
+		for (int i = 0; i < 8; i++)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+	}
+
+	return crc;
+}	// mbc_crc16
+
+/**********************************************************************
+	Build request into req: function 0x03 reading len registers at
+	addr, or 0x10 writing them from src. Returns frame length with CRC.
+**********************************************************************/
+int mbc_request(uint8_t *req, uint8_t slave, uint16_t addr, int len, const uint16_t *src)
+{
+	int reqLen = 6;
+
+	req[0] = slave;
+	req[1] = src ? 0x10 : 0x03;
+	req[2] = addr >> 8;
+	req[3] = addr & 0xFF;
+	req[4] = len >> 8;
+	req[5] = len & 0xFF;
+
+	if (src)
+	{
+		req[reqLen++] = 2 * len;
+		for (int i = 0; i < len; i++)
+		{
+			req[reqLen++] = src[i] >> 8;
+			req[reqLen++] = src[i] & 0xFF;
+		}
+	}
+
+	uint16_t crc = mbc_crc16(req, reqLen);
+
+	req[reqLen++] = crc & 0xFF;
+	req[reqLen++] = crc >> 8;
+
+	return reqLen;
+}	// mbc_request
+
+/**********************************************************************
+	Length of the response to req, known better with each byte.
+**********************************************************************/
+int mbc_expected(const uint8_t *req, const uint8_t *rsp, int rspLen)
+{
+	if ((rspLen >= 2) && (rsp[1] & 0x80))
+		return 5;		// exception response
+
+	if (req[1] == 0x10)
+		return 8;		// echo of slave, function, address, quantity
+
+	return 5 + 2 * ((req[4] << 8) | req[5]);
+}	// mbc_expected
+
+/**********************************************************************
+	Check complete response to req, registers read go to dest.
+	Returns 0 or error code.
+**********************************************************************/
+int mbc_response(const uint8_t *req, const uint8_t *rsp, int rspLen, uint16_t *dest)
+{
+	int len = (req[4] << 8) | req[5];
+
+	if ((rspLen < 5) || (mbc_crc16(rsp, rspLen - 2) != (rsp[rspLen - 2] | (rsp[rspLen - 1] << 8))))
+		return EMBBADCRC;
+	if (rsp[0] != req[0])
+		return EMBBADSLAVE;
+	if (rsp[1] == (req[1] | 0x80))
+		return MODBUS_ENOBASE + rsp[2];
+	if (req[1] == 0x10)
+		return memcmp(rsp, req, 6) ? EMBBADDATA : 0;
+	if ((rsp[1] != 0x03) || (rsp[2] != 2 * len) || (rspLen != 5 + 2 * len))
+		return EMBBADDATA;
+
+	for (int i = 0; i < len; i++)
+		dest[i] = (rsp[3 + 2 * i] << 8) | rsp[4 + 2 * i];
+
+	return 0;
+}	// mbc_response
+
+/**********************************************************************
+	Microseconds elapsed on CLOCK_MONOTONIC since ts.
+**********************************************************************/
+long mbc_usec_since(const struct timespec *ts)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - ts->tv_sec) * 1000000L + (now.tv_nsec - ts->tv_nsec) / 1000;
+}	// mbc_usec_since
+
+/**********************************************************************
+	Open serial device in non-blocking raw mode, exclusive.
+**********************************************************************/
+int mbc_open(mbc_bus_t *bus, const char *device, int baud, char parity, int dataBits, int stopBits)
+{
+	struct termios tios;
+	speed_t speed;
+
+	switch (baud)
+	{
+	case 1200:	speed = B1200;	break;
+	case 2400:	speed = B2400;	break;
+	case 4800:	speed = B4800;	break;
+	case 9600:	speed = B9600;	break;
+	case 19200:	speed = B19200;	break;
+	default:
+		errno = EINVAL;
+		return(-1);
+	}
+
+	memset(bus, 0, sizeof(*bus));
+
+	bus->fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (bus->fd < 0)
+		return(-1);
+
+	// O_EXCL does not lock a tty, TIOCEXCL keeps other opens out
+	if (ioctl(bus->fd, TIOCEXCL) < 0)
+	{
+		int err = errno;
+
+		close(bus->fd);
+		bus->fd = -1;
+		errno = err;
+		return(-1);
+	}
+
+	memset(&tios, 0, sizeof(tios));
+	cfmakeraw(&tios);
+	cfsetispeed(&tios, speed);
+	cfsetospeed(&tios, speed);
+	tios.c_cflag |= CREAD | CLOCAL;
+	tios.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB);
+	tios.c_cflag |= (dataBits == 7) ? CS7 : CS8;
+	if (parity == 'E')
+		tios.c_cflag |= PARENB;
+	else if (parity == 'O')
+		tios.c_cflag |= PARENB | PARODD;
+	if (stopBits == 2)
+		tios.c_cflag |= CSTOPB;
+	tios.c_cc[VMIN] = 1;		// with O_NONBLOCK: EAGAIN if empty, 0 only on hangup
+	tios.c_cc[VTIME] = 0;
+
+	if (tcsetattr(bus->fd, TCSANOW, &tios) < 0)
+	{
+		int err = errno;
+
+		close(bus->fd);
+		bus->fd = -1;
+		errno = err;
+		return(-1);
+	}
+	tcflush(bus->fd, TCIOFLUSH);
+
+	mbc_attach(bus, bus->fd, baud, parity, dataBits, stopBits);
+
+	return(0);
+}	// mbc_open
+
+/**********************************************************************
+	Use fd of a serial device opened and set up elsewhere, e.g. by
+	libmodbus, for mbc_read() and mbc_write(). Timing from the serial
+	parameters, timeouts set to the libmodbus defaults.
+**********************************************************************/
+void mbc_attach(mbc_bus_t *bus, int fd, int baud, char parity, int dataBits, int stopBits)
+{
+	// 1 start, data, parity, stop bits per character
+	int bits = 1 + dataBits + (parity != 'N') + stopBits;
+
+	memset(bus, 0, sizeof(*bus));
+	bus->fd = fd;
+	bus->charUsec = 1000000L * bits / baud;
+	bus->t35Usec = (baud > 19200) ? 1750 : 3500000L * bits / baud;
+	bus->responseUsec = 500000;		// libmodbus defaults
+	bus->byteUsec = 500000;
+	bus->turnaroundUsec = 50000;
+	clock_gettime(CLOCK_MONOTONIC, &bus->lastIO);
+}	// mbc_attach
+
+/**********************************************************************
+**********************************************************************/
+void mbc_close(mbc_bus_t *bus)
+{
+	if (bus->fd >= 0)
+		close(bus->fd);
+	bus->fd = -1;
+}	// mbc_close
+
+/**********************************************************************
+	One transaction: silence, request, response. Broadcasts wait for
+	the slaves to process the frame instead of a response.
+**********************************************************************/
+static int transact(mbc_bus_t *bus, uint8_t slave, uint16_t addr, int len, const uint16_t *src, uint16_t *dest)
+{
+	int reqLen, rspLen = 0;
+	long silence = mbc_usec_since(&bus->lastIO);
+
+	// nobody answers a broadcast, a read would return nothing
+	if ((len < 1) || (len > (src ? MBC_MAX_WRITE : MBC_MAX_READ)) || ((! src) && (slave == MBC_BROADCAST)))
+	{
+		errno = EINVAL;
+		return(-1);
+	}
+
+	if (silence < bus->t35Usec)
+		usleep(bus->t35Usec - silence);
+
+	reqLen = mbc_request(bus->req, slave, addr, len, src);
+
+	tcflush(bus->fd, TCIFLUSH);		// drop garbage from previous frames
+
+	if (write(bus->fd, bus->req, reqLen) != reqLen)
+		return(-1);
+	tcdrain(bus->fd);
+	clock_gettime(CLOCK_MONOTONIC, &bus->lastIO);
+
+	if (slave == MBC_BROADCAST)
+	{	// nobody answers
+		usleep(bus->turnaroundUsec);
+		return(0);
+	}
+
+	while (rspLen < mbc_expected(bus->req, bus->rsp, rspLen))
+	{
+		struct pollfd pfd = { .fd = bus->fd, .events = POLLIN };
+		int n = poll(&pfd, 1, (rspLen ? bus->byteUsec : bus->responseUsec) / 1000);
+
+		if ((n < 0) && (errno == EINTR))
+			continue;
+		if (n < 0)
+			return(-1);
+		if (n == 0)
+		{
+			errno = rspLen ? EMBBADDATA : ETIMEDOUT;
+			return(-1);
+		}
+
+		n = read(bus->fd, bus->rsp + rspLen, sizeof(bus->rsp) - rspLen);
+		if (n == 0)
+			errno = EIO;		// hangup, device gone
+		if ((n <= 0) && (errno != EAGAIN))
+			return(-1);
+
+		if (n > 0)
+		{
+			rspLen += n;
+			clock_gettime(CLOCK_MONOTONIC, &bus->lastIO);
+		}
+	}
+
+	if ((errno = mbc_response(bus->req, bus->rsp, mbc_expected(bus->req, bus->rsp, rspLen), dest)))
+		return(-1);
+
+	return(0);
+}	// transact
+
+/**********************************************************************
+	Read len registers at addr into dest, returns len or -1. Slave
+	0 (broadcast) fails with EINVAL.
+**********************************************************************/
+int mbc_read(mbc_bus_t *bus, uint8_t slave, uint16_t addr, int len, uint16_t *dest)
+{
+	return transact(bus, slave, addr, len, NULL, dest) ? -1 : len;
+}	// mbc_read
+
+/**********************************************************************
+	Write len registers at addr from src, slave 0 broadcasts.
+	Returns len or -1.
+**********************************************************************/
+int mbc_write(mbc_bus_t *bus, uint8_t slave, uint16_t addr, int len, const uint16_t *src)
+{
+	return transact(bus, slave, addr, len, src, NULL) ? -1 : len;
+}	// mbc_write
+
+/**********************************************************************
+	Register regNr in catalog terminated by regNr 0, NULL if unknown.
+**********************************************************************/
+const mbc_reg_t *mbc_lookup(const mbc_reg_t *catalog, uint16_t regNr)
+{
+	for (const mbc_reg_t *rd = catalog; rd->regNr; rd++)
+		if (rd->regNr == regNr)
+			return rd;
+
+	return NULL;
+}	// mbc_lookup
+
+/**********************************************************************
+	Numeric value of a register, for rate summaries the total.
+	NAN if not numeric.
+**********************************************************************/
+double mbc_value(uint8_t regType, int regBase10, const uint16_t *src)
+{
+	switch (regType)
+	{
+	case 1:
+		return (double) (((uint32_t) src[0] << 16) + src[1]);
+	case 2:
+	case 4:
+		return (((uint32_t) src[0] << 16) + src[1]) * pow(10, regBase10);
+	default:
+		return NAN;
+	}
+}	// mbc_value
+
+/**********************************************************************
+	Registers a value of regType needs at least, -1 for unknown types.
+	Type 0 is a disabled register.
+**********************************************************************/
+int mbc_type_len(uint8_t regType)
+{
+	switch (regType)
+	{
+	case 0:		return 0;
+	case 1:
+	case 2:
+	case 5:		return 2;
+	case 3:		return 4;
+	case 4:		return 8;
+	case 7:		return MBC_TARIFF_LEN;
+	case 8:		return 1;
+	default:	return -1;
+	}
+}	// mbc_type_len
+
+/**********************************************************************
+	Value of a register as text, unit appended if not NULL. Returns
+	length like snprintf(), -1 for unknown register types or regLen
+	shorter than the type needs.
+**********************************************************************/
+int mbc_format(uint8_t regType, int regBase10, int regLen, const uint16_t *src, const char *unit, char *buf, size_t size)
+{
+	int n = 0;
+
+	buf[0] = '\0';
+
+	if (regLen < mbc_type_len(regType))
+		return -1;
+
+	switch (regType)
+	{
+	case 1:
+		return snprintf(buf, size, "%u%s", ((uint32_t) src[0] << 16) + src[1], unit ? unit : "");
+	case 2:
+		return snprintf(buf, size, "%.*f%s", abs(regBase10), mbc_value(regType, regBase10, src), unit ? unit : "");
+	case 3:
+		// BCD: sec, min, hour, week, day, month, year, 20 shown as 20yy-mm-dd hh:mm:ss w
+		return snprintf(buf, size, "%02X%02X-%02X-%02X %02X:%02X:%02X %02X",
+			src[3] & 0xFF, src[3] >> 8, src[2] & 0xFF, src[2] >> 8, src[1] >> 8, src[0] & 0xFF, src[0] >> 8, src[1] & 0xFF);
+	case 4:
+		// total and rate 1-3
+		for (int j = 0; (j < 8) && ((size_t) n < size); j += 2)
+			n += snprintf(buf + n, size - n, "%s%.*f%s", j ? " " : "",
+				abs(regBase10), mbc_value(regType, regBase10, src + j), unit ? unit : "");
+		return n;
+	case 5:
+		// BCD: demand interval [min], slide time [min], display time [s], display interval [s]
+		return snprintf(buf, size, unit ? "%dmin %dmin %ds %ds" : "%d %d %d %d",
+			MBC_BCD2INT(src[0] >> 8), MBC_BCD2INT(src[0] & 0xFF), MBC_BCD2INT(src[1] >> 8), MBC_BCD2INT(src[1] & 0xFF));
+	case 7:
+		return mbc_format_tariff(src, buf, size);
+	case 8:
+		for (int j = 0; (j < regLen) && ((size_t) n < size); j++)
+			n += snprintf(buf + n, size - n, j ? " %04X" : "%04X", src[j]);
+		return n;
+	default:
+		return -1;
+	}
+}	// mbc_format
+
+/**********************************************************************
+	Tariff table 0xF700: 15 registers, 10 segments of 3 BCD bytes
+	tariff, minute, hour. Segments are in time order, unused segments
+	repeat the last one. Human readable: hh:mm=t,hh:mm=t,...
+**********************************************************************/
+int mbc_format_tariff(const uint16_t *src, char *buf, size_t size)
+{
+	uint8_t b[2 * MBC_TARIFF_LEN];
+	int n = 0, last;
+
+	for (int i = 0; i < MBC_TARIFF_LEN; i++)
+	{
+		b[2 * i] = src[i] >> 8;
+		b[2 * i + 1] = src[i] & 0xFF;
+	}
+
+	for (last = MBC_TARIFF_SEGMENTS - 1; (last > 0) && (memcmp(b + 3 * last, b + 3 * (last - 1), 3) == 0); last--)
+		;
+
+	buf[0] = '\0';
+	for (int i = 0; (i <= last) && ((size_t) n < size); i++)
+		n += snprintf(buf + n, size - n, "%s%02X:%02X=%X", i ? "," : "", b[3 * i + 2], b[3 * i + 1], b[3 * i]);
+
+	return n;
+}	// mbc_format_tariff
+
+/**********************************************************************
+	Convert schedule hh:mm=t,... into tariff registers, -1 with errno
+	EINVAL if invalid: times ascending, tariff 1-4, at most 10 segments.
+**********************************************************************/
+int mbc_parse_tariff(const char *str, uint16_t *dest)
+{
+	uint8_t b[2 * MBC_TARIFF_LEN];
+	int count = 0, prev = -1;
+
+	for (const char *cp = str; *cp; )
+	{
+		int hh, mm, t, pos = 0;
+
+		if ((sscanf(cp, "%d:%d=%d%n", &hh, &mm, &t, &pos) < 3) || ((cp[pos] != ',') && cp[pos])
+			|| (hh < 0) || (hh > 23) || (mm < 0) || (mm > 59) || (t < 1) || (t > 4)
+			|| (hh * 60 + mm <= prev) || (count == MBC_TARIFF_SEGMENTS))
+		{
+			errno = EINVAL;
+			return(-1);
+		}
+
+		prev = hh * 60 + mm;
+		b[3 * count] = MBC_INT2BCD(t);
+		b[3 * count + 1] = MBC_INT2BCD(mm);
+		b[3 * count + 2] = MBC_INT2BCD(hh);
+		count++;
+
+		cp += pos + (cp[pos] == ',');
+	}
+
+	if (! count)
+	{
+		errno = EINVAL;
+		return(-1);
+	}
+
+	for (int i = count; i < MBC_TARIFF_SEGMENTS; i++)
+		memcpy(b + 3 * i, b + 3 * (count - 1), 3);
+
+	for (int i = 0; i < MBC_TARIFF_LEN; i++)
+		dest[i] = (b[2 * i] << 8) | b[2 * i + 1];
+
+	return(0);
+}	// mbc_parse_tariff
+
+/**********************************************************************
+	Clock registers (0xF000) of local time tm.
+**********************************************************************/
+void mbc_encode_date(const struct tm *tm, uint16_t *dest)
+{
+	dest[0] = (MBC_INT2BCD(tm->tm_sec) << 8) | MBC_INT2BCD(tm->tm_min);
+	dest[1] = (MBC_INT2BCD(tm->tm_hour) << 8) | MBC_INT2BCD(tm->tm_wday);
+	dest[2] = (MBC_INT2BCD(tm->tm_mday) << 8) | MBC_INT2BCD(tm->tm_mon + 1);
+	dest[3] = (MBC_INT2BCD(tm->tm_year + 1900 - 2000) << 8) | MBC_INT2BCD(20);
+}	// mbc_encode_date
@@ -0,0 +1,78 @@
+#ifndef LIBMBC_H
+#define LIBMBC_H
+
+/*
+libmbc - DRT-301M energy meter access without a process per sample
+
+Everything lives in caller provided memory: a bus is an mbc_bus_t, reads
+and writes take the caller's register buffers, decoding writes into the
+caller's text buffer. There is no global state, a bus may be used by one
+thread at a time, different buses by different threads.
+
+Errors are returned as -1 with errno set, protocol errors use the codes
+of libmodbus (EMBBADCRC, EMBXILADD, ...), modbus_strerror() explains them.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#define MBC_MAX_ADU			256		// RTU frame
+#define MBC_MAX_READ		125		// registers per function 0x03
+#define MBC_MAX_WRITE		123		// registers per function 0x10
+#define MBC_BROADCAST		0
+
+#define MBC_TARIFF_REG		0xF700
+#define MBC_TARIFF_LEN		15		// registers
+#define MBC_TARIFF_SEGMENTS	10		// BCD tariff, minute, hour
+
+#define MBC_BCD2INT(A)		( ((A) >> 4) * 10 + ((A) & 0x0F) )
+#define MBC_INT2BCD(A)		( ((A) / 10 * 16) + ((A) % 10) )
+
+typedef struct {
+	uint16_t regNr;
+	uint16_t regLen;
+	uint8_t regType;		// 1 unsigned, 2 scaled, 3 date, 4 rate summary, 5 intervals, 7 tariff, 8 raw
+	int regBase10;
+	const char *unitStr;
+	const char *descStr;
+} mbc_reg_t;
+
+typedef struct {
+	int fd;
+	long charUsec;			// one character on the line
+	long t35Usec;			// 3.5 character inter frame silence
+	long responseUsec;		// first byte of response, set by mbc_open() to 500ms
+	long byteUsec;			// between bytes of response, set by mbc_open() to 500ms
+	long turnaroundUsec;	// processing of a broadcast, set by mbc_open() to 50ms
+	struct timespec lastIO;	// end of last byte sent or received
+	uint8_t req[MBC_MAX_ADU];
+	uint8_t rsp[MBC_MAX_ADU];
+} mbc_bus_t;
+
+extern const mbc_reg_t mbc_registers[];	// DRT-301M catalog, terminated by regNr 0
+
+// Transport
+int mbc_open(mbc_bus_t *bus, const char *device, int baud, char parity, int dataBits, int stopBits);
+void mbc_attach(mbc_bus_t *bus, int fd, int baud, char parity, int dataBits, int stopBits);
+void mbc_close(mbc_bus_t *bus);
+int mbc_read(mbc_bus_t *bus, uint8_t slave, uint16_t addr, int len, uint16_t *dest);
+int mbc_write(mbc_bus_t *bus, uint8_t slave, uint16_t addr, int len, const uint16_t *src);
+long mbc_usec_since(const struct timespec *ts);
+
+// Frames, for callers running their own event loop
+uint16_t mbc_crc16(const uint8_t *buf, int len);
+int mbc_request(uint8_t *req, uint8_t slave, uint16_t addr, int len, const uint16_t *src);
+int mbc_expected(const uint8_t *req, const uint8_t *rsp, int rspLen);
+int mbc_response(const uint8_t *req, const uint8_t *rsp, int rspLen, uint16_t *dest);
+
+// Catalog and decoding
+const mbc_reg_t *mbc_lookup(const mbc_reg_t *catalog, uint16_t regNr);
+int mbc_type_len(uint8_t regType);
+double mbc_value(uint8_t regType, int regBase10, const uint16_t *src);
+int mbc_format(uint8_t regType, int regBase10, int regLen, const uint16_t *src, const char *unit, char *buf, size_t size);
+int mbc_format_tariff(const uint16_t *src, char *buf, size_t size);
+int mbc_parse_tariff(const char *str, uint16_t *dest);
+void mbc_encode_date(const struct tm *tm, uint16_t *dest);
+
+#endif
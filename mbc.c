@@ -2,10 +2,31 @@
 #include <modbus/modbus.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <errno.h>
 #include <time.h>
 #include <string.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#include <libgen.h>
+#include <limits.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "libmbc.h"
 
 /*
 DRT-301M Multi Tariff Energy Meter with MODBUS RTU
@@ -19,7 +40,6 @@ meter default / slave address ist: 01
 
 ToDo:
 	* prevent multiple instances from interfering
-	* prefix output with timestamp of now
 	* several commandline options
 	* proper error handling 
 	* proper error reporting
@@ -40,111 +60,341 @@ typedef struct {
 	int regBase10;
 	const char * unitStr;
 	const char * descStr;
+	int regBlock;		// index into regBlock[], set by buildRegIndex()
 } regDef_s_t;
 
-regDef_s_t regDef[] = {
-	  { 0x0010,	2,	1,	 0,	"V",		"Voltage L1" }
-	, { 0x0012,	2,	1,	 0,	"V",		"Voltage L2" }
-	, { 0x0014,	2,	1,	 0,	"V",		"Voltage L3" }
-	, { 0x004E,	2,	1,	 0,	"Hz",		"Frequency" }		// !
-	, { 0x0050,	2,	2,	-2,	"A",		"Current L1" }
-	, { 0x0052,	2,	2,	-2,	"A",		"Current L2" }
-	, { 0x0054,	2,	2,	-2,	"A",		"Current L3" }
-	, { 0x0056,	2,	2,	-2,	"A",		"Current N" }
-	, { 0x0090,	2,	2,	-4,	"kW",		"Power L1" }
-	, { 0x0092,	2,	2,	-4,	"kW",		"Power L2" }
-	, { 0x0094,	2,	2,	-4,	"kW",		"Power L3" }
-	, { 0x0096,	2,	2,	-4,	"kW",		"Power Total" }
-	, { 0x00D0,	2,	2,	-4,	"kVA",		"Apparent Power L1" }
-	, { 0x00D2,	2,	2,	-4,	"kVA",		"Apparent Power L2" }
-	, { 0x00D4,	2,	2,	-4,	"kVA",		"Apparent Power L3" }
-	, { 0x00D6,	2,	2,	-4,	"kVA",		"Apparent Power Total" }
-	, { 0x0110,	2,	2,	-2,	"kvar",		"Reactive Power L1" }
-	, { 0x0112,	2,	2,	-2,	"kvar",		"Reactive Power L2" }
-	, { 0x0114,	2,	2,	-2,	"kvar",		"Reactive Power L3" }
-	, { 0x0116,	2,	2,	-2,	"kvar",		"Reactive Power Total" }
-	, { 0x0150,	2,	2,	-3,	"cos phi",	"Power Factor L1" }
-	, { 0x0152,	2,	2,	-3,	"cos phi",	"Power Factor L2" }
-	, { 0x0154,	2,	2,	-3,	"cos phi",	"Power Factor L3" }
-	, { 0x0156,	2,	2,	-3,	"cos phi",	"Power Factor Total" }
-	, { 0x0160,	2,	2,	-2,	"kWh",		"Import Energy" }
-	, { 0x0166,	2,	2,	-2,	"kWh",		"Export Energy" }
-	, { 0x07D0,	2,	2,	-2,	"kWh",		"Import Energy Rate 1" }
-	, { 0x07D2,	2,	2,	-2,	"kWh",		"Import Energy Rate 2" }
-	, { 0x07D4,	2,	2,	-2,	"kWh",		"Import Energy Rate 3" }
-	, { 0x07D6,	2,	2,	-2,	"kWh",		"Import Energy Rate 4" }
-	, { 0x08D0,	2,	2,	-2,	"kWh",		"Export Energy Rate 1" }
-	, { 0x08D2,	2,	2,	-2,	"kWh",		"Export Energy Rate 2" }
-	, { 0x08D4,	2,	2,	-2,	"kWh",		"Export Energy Rate 3" }
-	, { 0x08D6,	2,	2,	-2,	"kWh",		"Export Energy Rate 4" }
-	, { 0xF000,	4,	3,	 0,	"",			"Time/Date" }
-	, { 0xF111,	10,	4,	-2,	"kWh",		"Last 1 month positive Energy" }
-	, { 0xF121,	10,	4,	-2,	"kWh",		"Last 2 month positive Energy" }
-	, { 0xF131,	10,	4,	-2,	"kWh",		"Last 3 month positive Energy" }
-	, { 0xF141,	10,	4,	-2,	"kWh",		"Last 4 month positive Energy" }
-	, { 0xF151,	10,	4,	-2,	"kWh",		"Last 5 month positive Energy" }
-	, { 0xF161,	10,	4,	-2,	"kWh",		"Last 6 month positive Energy" }
-	, { 0xF171,	10,	4,	-2,	"kWh",		"Last 7 month positive Energy" }
-	, { 0xF181,	10,	4,	-2,	"kWh",		"Last 8 month positive Energy" }
-	, { 0xF191,	10,	4,	-2,	"kWh",		"Last 9 month positive Energy" }
-	, { 0xF1A1,	10,	4,	-2,	"kWh",		"Last 10 month positive Energy" }
-	, { 0xF1B1,	10,	4,	-2,	"kWh",		"Last 11 month positive Energy" }
-	, { 0xF1C1,	10,	4,	-2,	"kWh",		"Last 12 month positive Energy" }
-	, { 0xF211,	10,	4,	-2,	"kWh",		"Last 1 month reverse Energy" }
-	, { 0xF221,	10,	4,	-2,	"kWh",		"Last 2 month reverse Energy" }
-	, { 0xF231,	10,	4,	-2,	"kWh",		"Last 3 month reverse Energy" }
-	, { 0xF241,	10,	4,	-2,	"kWh",		"Last 4 month reverse Energy" }
-	, { 0xF251,	10,	4,	-2,	"kWh",		"Last 5 month reverse Energy" }
-	, { 0xF261,	10,	4,	-2,	"kWh",		"Last 6 month reverse Energy" }
-	, { 0xF271,	10,	4,	-2,	"kWh",		"Last 7 month reverse Energy" }
-	, { 0xF281,	10,	4,	-2,	"kWh",		"Last 8 month reverse Energy" }
-	, { 0xF291,	10,	4,	-2,	"kWh",		"Last 9 month reverse Energy" }
-	, { 0xF2A1,	10,	4,	-2,	"kWh",		"Last 10 month reverse Energy" }
-	, { 0xF2B1,	10,	4,	-2,	"kWh",		"Last 11 month reverse Energy" }
-	, { 0xF2C1,	10,	4,	-2,	"kWh",		"Last 12 month reverse Energy" }
-	, { 0xF311,	10,	4,	-4,	"kW",		"Last 1 month positive max Demand" }
-	, { 0xF321,	10,	4,	-4,	"kW",		"Last 2 month positive max Demand" }
-	, { 0xF331,	10,	4,	-4,	"kW",		"Last 3 month positive max Demand" }
-	, { 0xF341,	10,	4,	-4,	"kW",		"Last 4 month positive max Demand" }
-	, { 0xF351,	10,	4,	-4,	"kW",		"Last 5 month positive max Demand" }
-	, { 0xF361,	10,	4,	-4,	"kW",		"Last 6 month positive max Demand" }
-	, { 0xF371,	10,	4,	-4,	"kW",		"Last 7 month positive max Demand" }
-	, { 0xF381,	10,	4,	-4,	"kW",		"Last 8 month positive max Demand" }
-	, { 0xF391,	10,	4,	-4,	"kW",		"Last 9 month positive max Demand" }
-	, { 0xF3A1,	10,	4,	-4,	"kW",		"Last 10 month positive max Demand" }
-	, { 0xF3B1,	10,	4,	-4,	"kW",		"Last 11 month positive max Demand" }
-	, { 0xF3C1,	10,	4,	-4,	"kW",		"Last 12 month positive max Demand" }
-	, { 0xF411,	10,	4,	-4,	"kW",		"Last 1 month reverse max Demand" }
-	, { 0xF421,	10,	4,	-4,	"kW",		"Last 2 month reverse max Demand" }
-	, { 0xF431,	10,	4,	-4,	"kW",		"Last 3 month reverse max Demand" }
-	, { 0xF441,	10,	4,	-4,	"kW",		"Last 4 month reverse max Demand" }
-	, { 0xF451,	10,	4,	-4,	"kW",		"Last 5 month reverse max Demand" }
-	, { 0xF461,	10,	4,	-4,	"kW",		"Last 6 month reverse max Demand" }
-	, { 0xF471,	10,	4,	-4,	"kW",		"Last 7 month reverse max Demand" }
-	, { 0xF481,	10,	4,	-4,	"kW",		"Last 8 month reverse max Demand" }
-	, { 0xF491,	10,	4,	-4,	"kW",		"Last 9 month reverse max Demand" }
-	, { 0xF4A1,	10,	4,	-4,	"kW",		"Last 10 month reverse max Demand" }
-	, { 0xF4B1,	10,	4,	-4,	"kW",		"Last 11 month reverse max Demand" }
-	, { 0xF4C1,	10,	4,	-4,	"kW",		"Last 12 month reverse max Demand" }
-		
-	, { 0xF500,	 2,	5, 	 0,	"",			"Intervals & Times" }
-	, { 0xF600,	 0,	6,	 0,	"", 		"!!! Meter Number" }	// ! Not working?
-	, { 0xF700,	15,	7,	 0,	"",			"Tariff" }
-		
-	, { 0xF800,	 2,	1,	 0,	"Baud",		"!!!Baudrate" }	// ! Baudrate write only?
-			
-	, { 0xFA01,	10,	4,	-4,	"kW",		"Current month positive max Demand" }
-	, { 0xFB01,	10,	4,	-4,	"kW",		"Current month reverse max Demand" }
-		
-	, { 0x0000,	0,	0,	 0,	"",			"" }
+typedef struct {
+	uint16_t blkNr;		// first register of block
+	uint16_t blkLen;	// number of 16 bit registers to read
+} regBlock_s_t;
+
+typedef struct {
+	regDef_s_t *rd;
+	int block;			// index into readPlan_s_t.block[]
+	int offset;			// position of value in readPlan_s_t.buf[]
+} planItem_s_t;
+
+typedef struct {
+	uint16_t blkNr;
+	uint16_t blkLen;
+	int offset;			// position of block in readPlan_s_t.buf[]
+	int countItems;
+	char split;			// meter rejected coalesced read, read items one by one
+} planBlock_s_t;
+
+#define LAYOUT_LINES	'l'		// one value per line
+#define LAYOUT_CSV		'c'		// all values in one line, optional header with -t
+
+typedef struct readPlan_s {
+	char *name;
+	char layout;
+	int countItems;
+	int countVisible;		// items after countVisible are read but not printed
+	planItem_s_t *item;		// in output order
+	int countBlocks;
+	planBlock_s_t *block;	// in address order
+	int bufLen;				// registers needed to hold all blocks
+	char headerDone;		// csv header printed
+	int stampItem;			// item whose read is timestamped into clockTime, -1 none
+	struct readPlan_s *next;
+} readPlan_s_t;
+
+typedef struct {
+	const char *name;
+	char layout;
+	const char *regs;
+} reportDef_s_t;
+
+typedef struct {
+	const char *name;		// also matched in the Report Slave ID text
+	const uint16_t *absent;	// registers the model does not have, terminated by 0
+} model_s_t;
+
+typedef struct {
+	struct timespec monoStart, wallStart;	// request start
+	struct timespec monoEnd, wallEnd;		// response end
+} sampleTime_s_t;
+
+typedef struct rtuTrans_s {
+	uint8_t slave;
+	uint16_t addr;
+	uint16_t len;
+	uint16_t *dest;			// function 0x03: registers read
+	uint16_t *src;			// function 0x10: registers to write, else NULL
+	int rc;					// 0 ok, -1 failed with errno in err
+	int err;
+	sampleTime_s_t time;	// request sent, response done
+	void (*done)(struct rtuTrans_s *);
+	void *arg;
+	struct rtuTrans_s *next;
+} rtuTrans_s_t;
+
+struct rtuBus_s;
+
+typedef struct {
+	struct rtuBus_s *bus;
+	char isTimer;
+} rtuEvent_s_t;
+
+#define RTU_IDLE		0
+#define RTU_SILENCE		1		// waiting for inter frame silence before sending
+#define RTU_RECEIVING	2
+
+typedef struct rtuBus_s {
+	char *device;
+	int fd;
+	int timerFd;
+	rtuEvent_s_t evFd, evTimer;
+	long t35Usec;			// 3.5 character inter frame silence
+	int state;
+	rtuTrans_s_t *head;		// head is in flight
+	rtuTrans_s_t *tail;
+	uint8_t req[MODBUS_RTU_MAX_ADU_LENGTH];
+	uint8_t rsp[MODBUS_RTU_MAX_ADU_LENGTH];
+	int rspLen;
+	int expLen;
+	struct timespec lastIO;	// end of last byte sent or received
+	char dead;				// device gone, fd closed until reconnect
+} rtuBus_s_t;
+
+typedef struct {
+	readPlan_s_t *plan;
+	rtuBus_s_t *bus;
+	uint8_t slave;
+	uint16_t *buf;			// plan->bufLen registers
+	rtuTrans_s_t *trans;	// one per block and one per item
+	int outstanding;		// transactions submitted and not done
+	int failed;
+	sampleTime_s_t *time;	// response end is stamped when the last transaction is done
+	sampleTime_s_t *clockTime;	// transaction of plan->stampItem
+	const model_s_t *model;	// registers read, NULL all
+} planRun_s_t;
+
+typedef struct {
+	char valid;
+	double energyRef;		// Import Energy at last change [kWh]
+	double timeRef;			// monotonic time of last change [s]
+	double avgPower;		// over the last change of Import Energy [kW]
+	double rate[4];			// Import Energy Rate 1-4 of previous sample [kWh]
+} derivedState_s_t;
+
+typedef struct {
+	int importEnergy;		// plan item index of the registers used, -1 if unused
+	int current[3];
+	int rate[4];
+	int powerTotal;
+	int apparentTotal;
+	int reactiveTotal;
+	int pfTotal;
+} derivedPlan_s_t;
+
+typedef struct {
+	int intervalSec;		// demand interval of meter, 0 not read yet
+	int slideSec;
+	int countSlides;		// slides per interval
+	double *slideEnergy;	// ring of the last countSlides slides [kWs]
+	int head;				// slide in progress
+	int closed;				// slides completed without gap
+	time_t slideStart;
+	double lastPower;		// [kW], held until the next sample
+	double lastTime;		// wall clock [s]
+	double peak;			// highest demand of this month [kW]
+	int peakMonth;
+	time_t checkTime;		// last comparison with max demand of meter
+	char alarm;				// live demand above -demand limit
+} demandState_s_t;
+
+typedef struct {
+	double min;
+	double max;
+	double sum;
+	double last;
+	int count;				// samples in window, 0 if none
+} rollup_s_t;
+
+typedef struct {
+	int regNr;				// -1 all other registers
+	double band;
+	char relative;			// band in % of last emitted value
+} deadband_s_t;
+
+typedef struct meter_s {
+	char *name;				// slave address, prefixed by device if more than one
+	rtuBus_s_t *bus;		// -nb only, else ctx is used
+	char *device;			// device of -i, key of -cache entries
+	uint8_t slave;
+	int busIndex;			// position on its bus, for staggering
+	readPlan_s_t *plan;		// plan of buf / run
+	uint16_t *buf;
+	planRun_s_t *run;		// -nb only
+	sampleTime_s_t time;
+	sampleTime_s_t clockTime;	// transaction that read the plan's stampItem
+	int failed;
+	derivedState_s_t derived;
+	demandState_s_t demand;
+	const model_s_t *model;	// -model, NULL all registers
+	char modelDetected;		// -model auto found model
+	char *present;			// per plan item, NULL if the model has all
+	time_t *rollupStart;	// start of open window, per -rollup window
+	rollup_s_t *rollup;		// per -rollup window and visible plan item
+	uint16_t *writeAddr;	// queued register writes, ascending address
+	uint16_t *writeValue;
+	int countWrites;
+	uint16_t *cache;		// -cache: catalog registers at cacheOffset[] of their block
+	time_t *cacheTime;		// per catalog register, 0 never read
+	time_t *tryTime;		// per catalog register, last read-ahead
+	uint16_t *emitBuf;		// -deadband: registers last emitted, plan layout
+	time_t *emitTime;		// per visible plan item
+	char *emitted;			// visible items emitted by last sample
+	struct meter_s *next;
+} meter_s_t;
+
+typedef struct {			// settings of config file or command line, unset if 0 / NULL / -1
+	readPlan_s_t *reports;	// compiled reports
+	char *device;
+	char *report;			// polled report
+	int period;				// poll period [s], -1 demand interval
+	long staggerUsec;
+	uint8_t *slaves;
+	int countSlaves;
+	int *rollupWindows;
+	int countRollups;
+	struct timeval *responseTimeout;
+	struct timeval *byteTimeout;
+	char title;
+	char unit;
+	char timestamp;
+	char derived;
+	char *sink;
+	char *spool;
+	deadband_s_t *deadbands;
+	int countDeadbands;
+	int heartbeat;			// [s]
+	char demand;
+	double demandAlarm;		// [kW]
+	char *model;			// name or auto
+} config_s_t;
+
+typedef struct {
+	char *target;			// unix:<path> or tcp:<host>:<port>
+	struct sockaddr_storage addr;	// target resolved by sinkSetup()
+	socklen_t addrLen;
+	char *spoolFile;		// NULL drops batches while the receiver is down
+	int fd;					// -1 not connected
+	char connecting;		// tcp connect in progress
+	char *buf;				// lines not yet sent or spooled
+	size_t len;
+	size_t size;
+	size_t sent;			// head of first line in buf already sent
+	struct timespec batchStart;	// first line of buf
+	int spoolFd;
+	off_t spoolPos;			// replayed part of spool file
+	off_t spoolLine;		// start of the line at spoolPos
+	off_t spoolLen;
+	long dropped;			// lines lost without spool
+} sink_s_t;
+
+typedef struct {
+	readPlan_s_t *base;		// plan of -R, -r or poll
+	readPlan_s_t *plan;		// base plus hidden registers
+	int period;
+	long stagger;
+	int maxBusIndex;
+	int clockItem;			// plan item of clock with -checkDate, else -1
+	int powerItem;			// plan item of Power Total with -demand, else -1
+	derivedPlan_s_t dp;
+} daemon_s_t;
+
+regDef_s_t *regDef;		// active register catalog, terminated by regNr 0
+int countRegDef = 0;
+
+uint16_t regIndex[0x10000];			// register address -> catalog index + 1, 0 if undefined
+
+regBlock_s_t *regBlock = NULL;		// contiguous catalog ranges readable with one request
+int countRegBlocks = 0;
+
+reportDef_s_t reportDefault[] = {
+	  { "1",	LAYOUT_LINES,	"0x0160" }		// Import Energy
+	, { "2",	LAYOUT_LINES,	"0x0010,0x0012,0x0014,"		// Voltage
+								"0x0050,0x0052,0x0054,0x0056" }		// Current
+	, { "3",	LAYOUT_LINES,	"0x0090,0x0092,0x0094,0x0096,"		// Power
+								"0x00D0,0x00D2,0x00D4,0x00D6,"		// Apparent Power
+								"0x0110,0x0112,0x0114,0x0116,"		// Reactive Power
+								"0x0150,0x0152,0x0154,0x0156" }		// Power Factor
+	, { "4",	LAYOUT_LINES,	"0xF111" }
+	, { NULL,	0,				NULL }
+};
+
+/*
+Similar meters share the protocol and the catalog, single phase models
+have no meaningful L2, L3 and N registers.
+*/
+const uint16_t singlePhaseAbsent[] = {
+	  0x0012, 0x0014						// Voltage
+	, 0x0052, 0x0054, 0x0056				// Current, N
+	, 0x0092, 0x0094						// Power
+	, 0x00D2, 0x00D4						// Apparent Power
+	, 0x0112, 0x0114						// Reactive Power
+	, 0x0152, 0x0154						// Power Factor
+	, 0
+};
+
+const model_s_t models[] = {
+	  { "DRT-301M",	NULL }
+	, { "DRT-301C",	NULL }					// also DRT-301C-II
+	, { "DRS-202M",	singlePhaseAbsent }
+	, { "DRS-202C",	singlePhaseAbsent }
+	, { NULL,		NULL }
 };
 
+// catalog entries no model reads: meter number fails, baudrate is write only
+const uint16_t unreadableRegs[] = { 0xF600, 0xF800, 0 };
+
+config_s_t config = { .staggerUsec = -1 };		// active config file, its reports and reportDefault[] used
+config_s_t cmdline = { .staggerUsec = -1 };		// command line, overrides config file
+
+#define defaultMaxBlockLen		32	// registers per coalesced read, MODBUS allows up to 125
+int maxBlockLen = defaultMaxBlockLen;
+
 char optSetDate = 0;
-char optCheckDate = 0;
+int  optCheckDate = 0;		// max clock drift [s] before resync with -setDate
 int  optSetBaudrate = 0;
+char *optTariff = NULL;		// -tariff / -setTariff schedule
+char optSetTariff = 0;
+int  optBroadcast = -1;		// -setDate by broadcast, number of meters verified
+char *optSink = NULL;
+char *optSpool = NULL;
+char *optCacheFile = NULL;		// -d writes register cache, else plan is read from it
+int  optReadAhead = 0;			// refresh cache in idle time if older [s], 0 off
+int  optMaxAge = 0;				// reading from cache: max age [s], 0 any
+long optFlushUsec = 1000000;	// max age of a sink batch
+int  optLowLatency = 0;		// FTDI latency timer [ms], 0 leave tty as is
+char optRs485 = 0;
+char optBatch = 0;
+char *optModel = NULL;			// -model name or auto, NULL all registers
+char *optBatchFile = NULL;		// -batch input, stdin if NULL
+char *optConvert = NULL;		// -convert files, comma separated
+int  optThreads = 0;			// -convert workers, 0 one per online cpu
 char optUnit = 0;
 char optTitle = 0;
-char optReport = 0;
+char *optReport = NULL;
+char *optConfigFile = NULL;
+char optNonBlocking = 0;
+int  optDaemon = 0;			// poll period [s], -1 demand interval of meter
+char optTimestamp = 0;
+char optDerived = 0;
+long optStaggerUsec = -1;	// -1 estimate from read plan
+char optScan = 0;
+unsigned int scanFirst, scanLast;
+int *rollupWindows = NULL;	// -rollup window lengths [s]
+deadband_s_t *deadbands = NULL;	// -deadband, report by exception if any
+int countDeadbands = 0;
+int optHeartbeat = 0;			// max silence of a value with -deadband [s]
+char optDemand = 0;
+double optDemandAlarm = 0;		// live demand limit [kW], 0 none
+int countRollups = 0;
+uint8_t *slaveList = NULL;
+int countSlaves = 0;
 char optHelp = 0;
 char optVerbose = 0;
 char optSlaveAddress = 0;
@@ -178,6 +428,38 @@ char slaveAddress = defaultSlaveAddress;
 
 char verbose;
 
+meter_s_t *meters = NULL;
+int countMeters = 0;
+rtuBus_s_t **buses = NULL;	// -nb only
+int countBuses = 0;
+volatile sig_atomic_t daemonStop = 0;
+volatile sig_atomic_t daemonReload = 0;
+int *cacheOffset = NULL;		// position of catalog block in meter cache
+int cacheLen = 0;
+char *cacheSplit = NULL;		// per catalog block: meter rejects block read
+char ctxDead = 0;				// device of ctx gone, reconnect pending
+mbc_bus_t ctxBus;				// register reads of ctx go through libmbc
+int deviceWatchFd = -1;			// inotify on directories of gone devices
+sink_s_t sink = { .fd = -1, .spoolFd = -1 };
+
+#define sinkBatchBytes		65536	// flush sink batch when reached
+#define sinkChunkBytes		65536	// spool replay per flush
+
+
+#define defaultTurnaroundUsec	50000	// meter processing time per request, for staggering
+#define defaultHeartbeat		900		// -heartbeat [s]
+#define demandCheckSec			3600	// compare local peak with meter max demand
+#define defaultReadAhead		300		// -readAhead [s]
+#define defaultLatencyTimer		1		// -lowLatency [ms], FTDI default is 16
+#define latencyProbeReads		8		// reads per measurement of -lowLatency
+#define latencyProbeReg			0x0010	// Voltage L1, readable on every model
+#define batchMaxMerge			64		// -batch reads merged into one read plan
+#define convertChunkBytes		(1 << 20)	// -convert input per chunk
+#define convertMaxLine			1024	// longest cache line, as read by cachePlan()
+
+int epollFd = -1;
+int rtuPending = 0;		// transactions submitted and not yet done
+
 /**********************************************************************
 **********************************************************************/
 #if 0
@@ -202,555 +484,6403 @@ uint32_t read32(uint16_t addr)
 #endif
 
 /**********************************************************************
+	Use the built in catalog of libmbc.
 **********************************************************************/
-int setDate(modbus_t *_ctx, struct tm *_tm)
+void defaultRegDef(void)
 {
-	struct tm *raw_tm;
+	int count = 0;
 
-	if (_tm)
-	{	
-		raw_tm = _tm;
-	} 
-	else
-	{	// use now as time
-		time_t raw_time; 
-		
-		time(&raw_time);
-		
-		raw_tm = localtime(&raw_time);
+	while (mbc_registers[count].regNr)
+		count++;
+
+	if (! (regDef = calloc(count + 1, sizeof(*regDef))))
+	{
+		printf("defaultRegDef malloc failed\n");
+		abort();
 	}
 
-	raw_tm->tm_year += 1900;
-	raw_tm->tm_mon  +=    1;
-	
-	if (verbose > 3)
-		printf("Set Time: %04d-%02d-%02d %02d:%02d:%02d\n", raw_tm->tm_year, raw_tm->tm_mon, raw_tm->tm_mday, raw_tm->tm_hour, raw_tm->tm_min, raw_tm->tm_sec);
+	for (int i = 0; i < count; i++)
+	{
+		regDef[i].regNr		= mbc_registers[i].regNr;
+		regDef[i].regLen	= mbc_registers[i].regLen;
+		regDef[i].regType	= mbc_registers[i].regType;
+		regDef[i].regBase10	= mbc_registers[i].regBase10;
+		regDef[i].unitStr	= mbc_registers[i].unitStr;
+		regDef[i].descStr	= mbc_registers[i].descStr;
+	}
+}	// defaultRegDef
 
-//	return 0;
+/**********************************************************************
+	Load register catalog from file, same format as written by -l:
+	0xADDR len type base10<TAB>unit<TAB>description
+	Empty lines and lines starting with # are ignored.
+**********************************************************************/
+int loadRegDef(const char *fileName)
+{
+	FILE *fp = fopen(fileName, "r");
+	char line[256];
+	int lineNr = 0;
+	int count = 0;
+	regDef_s_t *rd = NULL;
 
-	// write to DRT
-	// 0xF000: sec, min, hour, week, day, month, year, 20
+	if (! fp)
+	{
+		printf("Open register definition file '%s' failed: %s\n", fileName, strerror(errno));
+		return(-1);
+	}
 
-	uint8_t raw_req[] = { 
-		0x01,				// Device ID
-		0x10, 				// Write multiple register
-		0xF0, 0x00,			// Start address
-		0x00, 0x04,			// Quantity of registers
-		0x08,				// Byte count
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 
-	};		// Date
-	
-	#define OFFSET	7
-	#define INT2BCD(A) ( ((A) / 10 * 16) + ((A) % 10) )
-	raw_req[OFFSET + 0] = INT2BCD(raw_tm->tm_sec);
-	raw_req[OFFSET + 1] = INT2BCD(raw_tm->tm_min);
-	raw_req[OFFSET + 2] = INT2BCD(raw_tm->tm_hour);
-	raw_req[OFFSET + 3] = INT2BCD(raw_tm->tm_wday);
-	raw_req[OFFSET + 4] = INT2BCD(raw_tm->tm_mday);
-	raw_req[OFFSET + 5] = INT2BCD(raw_tm->tm_mon);
-	raw_req[OFFSET + 6] = INT2BCD(raw_tm->tm_year - 2000);
-	raw_req[OFFSET + 7] = INT2BCD(20);
+	while (fgets(line, sizeof(line), fp))
+	{
+		unsigned int nr, len, type;
+		int base, pos = 0;
 
-	uint8_t rsp[MODBUS_TCP_MAX_ADU_LENGTH];
+		lineNr++;
+		line[strcspn(line, "\r\n")] = '\0';
 
-	int req_length = modbus_send_raw_request(ctx, raw_req, sizeof(raw_req));
-	int res_length = modbus_receive_confirmation(ctx, rsp);
+		if ((line[0] == '#') || (line[strspn(line, " \t")] == '\0'))
+			continue;
 
-	if (verbose > 2)
-		printf("0x%04X REQ Length: %d RES Length: %d\n", 0xF000, req_length, res_length);
+		// len has to hold a value of type, decoding reads that many
+		if ((sscanf(line, "%i %i %i %i%n", &nr, &len, &type, &base, &pos) < 4)
+			|| (nr == 0) || (nr > 0xFFFF) || (len > 125) || (line[pos] != '\t')
+			|| (type > 0xFF) || (mbc_type_len(type) < 0) || (len < mbc_type_len(type)))
+		{
+			printf("%s:%d: invalid register definition '%s'\n", fileName, lineNr, line);
+			fclose(fp);
+			free(rd);
+			return(-1);
+		}
 
-	if (res_length <= 0)
-		return(-1);
-		
-	if (verbose > 2)
-	{
-		printf("0x%04X Response [", 0xF000);
-		for (int i = 0; i < res_length; i++)
+		char *unit = line + pos + 1;
+		char *desc = strchr(unit, '\t');
+		if (desc)
+			*desc++ = '\0';
+		else
+			desc = "";
+
+		// keep room for terminating entry
+		regDef_s_t *rd_p = realloc(rd, (count + 2) * sizeof(*rd));
+		if (! rd_p)
 		{
-			printf("%02X", rsp[i]);
-			if (i < res_length - 1)
-				printf(" ");
+			printf("loadRegDef realloc failed\n");
+			abort();
 		}
-		printf("]\n");
+		rd = rd_p;
+
+		rd[count].regNr		= nr;
+		rd[count].regLen	= len;
+		rd[count].regType	= type;
+		rd[count].regBase10	= base;
+		rd[count].unitStr	= strdup(unit);
+		rd[count].descStr	= strdup(desc);
+		rd[count].regBlock	= -1;
+		count++;
 	}
 
-	return 0;
-}	// setDate
+	fclose(fp);
+
+	if (! count)
+	{
+		printf("%s: no register definitions found\n", fileName);
+		free(rd);
+		return(-1);
+	}
+
+	memset(&rd[count], 0, sizeof(*rd));
+
+	if (verbose > 2)
+		printf("Loaded %d register definitions from %s\n", count, fileName);
+
+	free(regDef);		// built in catalog, its strings belong to libmbc
+	regDef = rd;
+
+	return(0);
+}	// loadRegDef
 
 /**********************************************************************
 **********************************************************************/
-int dumpRegister(unsigned int reg)
+int cmpRegNr(const void *a, const void *b)
+{
+	return (int) regDef[*(const int *) a].regNr - (int) regDef[*(const int *) b].regNr;
+}	// cmpRegNr
+
+/**********************************************************************
+	Build address index and block membership of active register catalog.
+	Catalog entries adjacent in address space are merged into one block
+	as long as it does not exceed maxBlockLen registers.
+**********************************************************************/
+void buildRegIndex(void)
 {
-	uint16_t dest[256];
-	uint8_t *bp = (uint8_t *) dest;
-	int rc;
 	int i;
 
-	for (i = 0; regDef[i].regNr && (regDef[i].regNr != reg); i++)
-			if (verbose > 3)
-				printf("Search Register Definition: %04X, %d, %d, %d\n", regDef[i].regNr, regDef[i].regLen, regDef[i].regType, regDef[i].regBase10)
-	;
-	
-	if (! regDef[i].regNr)
+	memset(regIndex, 0, sizeof(regIndex));
+
+	for (countRegDef = 0; regDef[countRegDef].regNr; countRegDef++)
 	{
-		printf("Undefined register %04X (%d)\n", reg, i);
-		abort();
+		if (regIndex[regDef[countRegDef].regNr])
+		{
+			printf("Duplicate register definition %04X\n", regDef[countRegDef].regNr);
+			abort();
+		}
+		regIndex[regDef[countRegDef].regNr] = countRegDef + 1;
 	}
 
-	int reg_addr = regDef[i].regNr;
-	int reg_size = regDef[i].regLen;
-	int reg_type = regDef[i].regType;
-	int reg_base = regDef[i].regBase10;
-
-	if (verbose > 3)
-		printf("Found Register Definition: %04X, %d, %d, %d\n", reg_addr, reg_size, reg_type, reg_base);
-
-	if (verbose > 3)
-		printf("To Dump %04X: reg_def[%d]=%04X, %d, %d, %d\n", reg, i, reg_addr, reg_size, reg_type, reg_base);
-
-	rc = modbus_read_registers(ctx, reg_addr, reg_size, dest);
-	if (rc == -1)
+	int *sorted = malloc(countRegDef * sizeof(*sorted));
+	free(regBlock);
+	regBlock = malloc(countRegDef * sizeof(*regBlock));
+	if ((! sorted) || (! regBlock))
 	{
-		printf("Read register failed: %s\n", modbus_strerror(errno));
+		printf("buildRegIndex malloc failed\n");
 		abort();
 	}
 
-	unsigned int ul = 0;
-	float f = 0;
+	for (i = 0; i < countRegDef; i++)
+		sorted[i] = i;
+	qsort(sorted, countRegDef, sizeof(*sorted), cmpRegNr);
 
-	switch (reg_type)
+	countRegBlocks = 0;
+	for (i = 0; i < countRegDef; i++)
 	{
-	case 0:
-		printf("Register disabled\n");
+		regDef_s_t *rd = &regDef[sorted[i]];
 
-		return(0);
-		break;
-	case 1:
-		if (verbose > 3)
-			printf("Unsigned Int Register:\n");
-			
-		ul = (dest[0] << 16) + dest[1];
-		
-		if (optTitle)
-			printf("%s: ", regDef[i].descStr);
+		int bad = 0;
 
-		printf("%u", ul);
+		while (unreadableRegs[bad] && (unreadableRegs[bad] != rd->regNr))
+			bad++;
 
-		if (optUnit)
-			printf("%s", regDef[i].unitStr);
-		
-		printf("\n");
-		
-		return(0);
-		break;
-	case 2:
-		if (verbose > 3)
-			printf("Float Register:\n");
+		if ((! rd->regLen) || (! rd->regType) || unreadableRegs[bad])
+		{	// not readable
+			rd->regBlock = -1;
+			continue;
+		}
 
-		f = dest[0];
-		f *= 256 * 256;
-		f += dest[1];
-//		f *= exp10(reg_base);
-		f *= pow(10, reg_base);
-		
-		if (optTitle)
-			printf("%s: ", regDef[i].descStr);
-			
-		printf("%.*f", abs(reg_base), f);
-		
-		if (optUnit)
-			printf("%s", regDef[i].unitStr);
-		
-		printf("\n");
-		return(0);
-		break;
-	case 3:
-		if (verbose > 3)
-			printf("Time Register:\n");
+		regBlock_s_t *blk = countRegBlocks ? &regBlock[countRegBlocks - 1] : NULL;
 
-		printf("%02X%02X-%02X-%02X %02X:%02X:%02X %02X\n", bp[6], bp[7], bp[4], bp[5], bp[3], bp[0], bp[1], bp[2]);
-		return(0);
-		break;
-	case 4:
-		if (verbose > 3)
-			printf("Rate Summary:\n");
+		if (blk && (blk->blkNr + blk->blkLen == rd->regNr) && (blk->blkLen + rd->regLen <= maxBlockLen))
+		{	// extend current block
+			blk->blkLen += rd->regLen;
+		} else {
+			blk = &regBlock[countRegBlocks++];
+			blk->blkNr = rd->regNr;
+			blk->blkLen = rd->regLen;
+		}
 
-		if (optTitle)
-			printf("%s: ", regDef[i].descStr);
+		rd->regBlock = countRegBlocks - 1;
+	}
 
-		for (int j = 0; j < 8; j += 2)
-		{
-			f = (dest[j] * 256 * 256 + dest[j + 1]) * pow(10, reg_base);
-			printf("%.*f", abs(reg_base), f);
-			if (optUnit)
-				printf("%s ", regDef[i].unitStr);
-		}
+	free(sorted);
 
-		printf("\n");
+	if (verbose > 3)
+		for (i = 0; i < countRegBlocks; i++)
+			printf("Register Block %d: %04X, %d\n", i, regBlock[i].blkNr, regBlock[i].blkLen);
+}	// buildRegIndex
+
+/**********************************************************************
+**********************************************************************/
+regDef_s_t *lookupRegDef(unsigned int reg)
+{
+	if ((reg > 0xFFFF) || (! regIndex[reg]))
+		return NULL;
+
+	return &regDef[regIndex[reg] - 1];
+}	// lookupRegDef
+
+/**********************************************************************
+	Print value of register rd from its raw registers in dest.
+	title selects the "description: " prefix, end is printed after the value.
+**********************************************************************/
+int printRegister(regDef_s_t *rd, uint16_t *dest, char title, const char *end)
+{
+	char buf[1024];		// 125 raw registers
+
+	if (rd->regType == 0)
+	{
+		printf("Register disabled%s", end);
 		return(0);
-		break;
-	default:
-		printf("dumpRegister: Unimplemented Register Type: %d\n", reg_type);
+	}
+
+	if (mbc_format(rd->regType, rd->regBase10, rd->regLen, dest, optUnit ? rd->unitStr : NULL, buf, sizeof(buf)) < 0)
+	{
+		printf("printRegister: Unimplemented Register Type: %d%s", rd->regType, end);
 		return(0);
-		break;
 	}
-	
+
+	if (verbose > 3)
+		printf("Register type %d:\n", rd->regType);
+
+	if (title)
+		printf("%s: ", rd->descStr);
+
+	printf("%s%s", buf, end);
+
 	return(0);
-}	// dumpRegister
+}	// printRegister
 
 /**********************************************************************
+	Print a computed value like printRegister() does.
 **********************************************************************/
-int setBaudrate(modbus_t * _ctx, int _baudrate)
+void printValue(const char *prefix, const char *title, double value, int decimals, const char *unit)
 {
-	int value = 0;
+	printf("%s", prefix);
 
-	switch (_baudrate)
+	if (optTitle)
+		printf("%s: ", title);
+
+	if (isnan(value))
+		printf("-");
+	else
+		printf("%.*f", decimals, value);
+
+	if (optUnit)
+		printf("%s", unit);
+
+	printf("\n");
+}	// printValue
+
+int ctxRead(uint16_t addr, int len, uint16_t *dest);
+
+/**********************************************************************
+**********************************************************************/
+int dumpRegister(unsigned int reg)
+{
+	uint16_t dest[256];
+	int rc;
+	regDef_s_t *rd = lookupRegDef(reg);
+
+	if (! rd)
 	{
-	case 1200:
-		value = 1;
-		break;
-	case 2400:
-		value = 2;
-		break;
-	case 4800:
-		value = 3;
-		break;
-	case 9600:
-		value = 4;
-		break;
-	default:
-		printf("Error setBaudrate: %i Baud not supported.\n", _baudrate);
-		return -1;
+		printf("Undefined register %04X\n", reg);
+		abort();
 	}
-	
-	//0xF800
-	// 0x01, 0x10, 0xF8, 0x00, value
-
-	uint8_t raw_req[] = { 
-		0x01,				// Device ID
-		0x10, 				// Write multiple register
-		0xF8, 0x00,			// Start address
-		0x00, 0x01,			// Quantity of registers
-		0x02,				// Byte count
-		0x00, 0x00
-	};		// Date
-	
-	#define OFFSET	7
-	raw_req[OFFSET + 0] = 0;
-	raw_req[OFFSET + 1] = value;
 
-	uint8_t rsp[MODBUS_TCP_MAX_ADU_LENGTH];
+	if (verbose > 3)
+		printf("Found Register Definition: %04X, %d, %d, %d, block %d\n", rd->regNr, rd->regLen, rd->regType, rd->regBase10, rd->regBlock);
 
-	int req_length = modbus_send_raw_request(ctx, raw_req, sizeof(raw_req));
-	int res_length = modbus_receive_confirmation(ctx, rsp);
+	rc = ctxRead(rd->regNr, rd->regLen, dest);
+	if (rc == -1)
+	{
+		printf("Read register failed: %s\n", modbus_strerror(errno));
+		abort();
+	}
 
-	if (verbose > 2)
-		printf("0x%04X REQ Length: %d RES Length: %d\n", 0xF000, req_length, res_length);
+	return printRegister(rd, dest, optTitle, "\n");
+}	// dumpRegister
 
-	if (res_length <= 0)
-		return(-1);
-		
-	if (verbose > 2)
-	{
-		printf("0x%04X Response [", 0xF000);
-		for (int i = 0; i < res_length; i++)
+/**********************************************************************
+	Convert comma separated list of registers into array, returns count.
+**********************************************************************/
+int parseRegList(const char *str, unsigned int **list)
+{
+	char *copy = strdup(str);
+	int count = 0;
+
+	*list = NULL;
+
+	for (char *cp = strtok(copy, ","); cp; cp = strtok(NULL, ","))
+	{	// read man page for features and behaviour (",.." "...," ".,,,.")
+		long int li = strtol(cp, NULL, 0);	// convert ASCII dec, hex, oct to number
+
+		if (verbose > 3)
+			printf("Token[%d]: %s %ld %ld\n", count + 1, cp, strlen(cp), li);
+
+		// extend reg array by one and add new value to end
+		unsigned int *ui_p = realloc(*list, (count + 1) * sizeof(**list));
+		if (! ui_p)
 		{
-			printf("%02X", rsp[i]);
-			if (i < res_length - 1)
-				printf(" ");
+			printf("parseRegList realloc failed\n");
+			abort();
 		}
-		printf("]\n");
+		*list = ui_p;
+		(*list)[count++] = (unsigned int) li;
 	}
 
-	return 0;
-}	// setBaudrate
+	free(copy);
+
+	return count;
+}	// parseRegList
 
 /**********************************************************************
+	Convert comma separated deadbands [reg=]band[%] into array, a band
+	without register applies to all others. Returns count or -1.
 **********************************************************************/
-void dumpRegDef()
+int parseDeadbands(const char *str, deadband_s_t **list)
 {
-	for (int i = 0; regDef[i].regNr; i++ )
+	char *copy = strdup(str);
+	int count = 0;
+
+	*list = NULL;
+
+	for (char *cp = strtok(copy, ","); cp; cp = strtok(NULL, ","))
 	{
-		printf("0x%04X %4d %4d %4d\t%s\t%s\n",
-			regDef[i].regNr,
-			regDef[i].regLen,
-			regDef[i].regType,
-			regDef[i].regBase10,
-			regDef[i].unitStr,
+		deadband_s_t db = { .regNr = -1 };
+		char *eq = strchr(cp, '=');
+		char *end;
+
+		if (eq)
+		{
+			*eq = '\0';
+			db.regNr = strtol(cp, &end, 0);
+			if ((end == cp) || *end || (db.regNr < 0) || (db.regNr > 0xFFFF))
+				db.regNr = -2;
+			cp = eq + 1;
+		}
+
+		db.band = strtod(cp, &end);
+		if (*end == '%')
+		{
+			db.relative = 1;
+			end++;
+		}
+
+		if ((db.regNr < -1) || (end == cp) || *end || (db.band < 0))
+		{
+			free(copy);
+			free(*list);
+			*list = NULL;
+			return -1;
+		}
+
+		deadband_s_t *dp = realloc(*list, (count + 1) * sizeof(**list));
+		if (! dp)
+		{
+			printf("parseDeadbands realloc failed\n");
+			abort();
+		}
+		*list = dp;
+		(*list)[count++] = db;
+	}
+
+	free(copy);
+
+	return count;
+}	// parseDeadbands
+
+/**********************************************************************
+	Convert comma separated list of durations (60, 60s, 15m, 1h) into
+	array of seconds, returns count or -1 if invalid.
+**********************************************************************/
+int parseDurationList(const char *str, int **list)
+{
+	char *copy = strdup(str);
+	int count = 0;
+
+	*list = NULL;
+
+	for (char *cp = strtok(copy, ","); cp; cp = strtok(NULL, ","))
+	{
+		char *end;
+		long int li = strtol(cp, &end, 0);
+
+		switch (*end)
+		{
+		case 'h':
+			li *= 60;
+			// fall through
+		case 'm':
+			li *= 60;
+			// fall through
+		case 's':
+			end++;
+		}
+
+		if ((li <= 0) || *end)
+		{
+			free(copy);
+			return -1;
+		}
+
+		int *ip = realloc(*list, (count + 1) * sizeof(**list));
+		if (! ip)
+		{
+			printf("parseDurationList realloc failed\n");
+			abort();
+		}
+		*list = ip;
+		(*list)[count++] = (int) li;
+	}
+
+	free(copy);
+
+	return count;
+}	// parseDurationList
+
+/**********************************************************************
+	Single duration in seconds, -1 if invalid.
+**********************************************************************/
+int parseDuration(const char *str)
+{
+	int *list;
+	int sec = (parseDurationList(str, &list) == 1) ? list[0] : -1;
+
+	free(list);
+
+	return sec;
+}	// parseDuration
+
+/**********************************************************************
+**********************************************************************/
+void freeReadPlan(readPlan_s_t *plan)
+{
+	if (! plan)
+		return;
+
+	free(plan->name);
+	free(plan->item);
+	free(plan->block);
+	free(plan);
+}	// freeReadPlan
+
+/**********************************************************************
+	Compile list of registers into a read plan: the catalog blocks
+	touched by the registers are clipped to the requested range and
+	read with one request each. Plans are compiled once and reused.
+**********************************************************************/
+readPlan_s_t *compileReadPlan(const char *name, char layout, unsigned int *regs, int count)
+{
+	if (count <= 0)
+	{
+		printf("No registers in report '%s'\n", name);
+		return NULL;
+	}
+
+	readPlan_s_t *plan = calloc(1, sizeof(*plan));
+	int *blkFirst = malloc(countRegBlocks * sizeof(*blkFirst));
+	int *blkEnd = malloc(countRegBlocks * sizeof(*blkEnd));
+	int *blkMap = malloc(countRegBlocks * sizeof(*blkMap));
+	int i;
+
+	if ((! plan) || (! blkFirst) || (! blkEnd) || (! blkMap)
+		|| (! (plan->item = calloc(count, sizeof(*plan->item))))
+		|| (! (plan->block = calloc(count, sizeof(*plan->block)))))
+	{
+		printf("compileReadPlan malloc failed\n");
+		abort();
+	}
+
+	plan->name = strdup(name);
+	plan->layout = layout;
+	plan->stampItem = -1;
+
+	for (i = 0; i < countRegBlocks; i++)
+		blkFirst[i] = -1;
+
+	for (i = 0; i < count; i++)
+	{
+		regDef_s_t *rd = lookupRegDef(regs[i]);
+
+		if (! rd)
+		{
+			printf("Undefined register %04X in report '%s'\n", regs[i], name);
+			goto fail;
+		}
+
+		if (rd->regBlock < 0)
+		{
+			printf("Register %04X in report '%s' is not readable\n", regs[i], name);
+			goto fail;
+		}
+
+		plan->item[plan->countItems++].rd = rd;
+		plan->countVisible = plan->countItems;
+
+		int b = rd->regBlock;
+		if (blkFirst[b] < 0)
+		{	// first register of this block
+			blkFirst[b] = rd->regNr;
+			blkEnd[b] = rd->regNr + rd->regLen;
+		}
+		if (rd->regNr < blkFirst[b])
+			blkFirst[b] = rd->regNr;
+		if (rd->regNr + rd->regLen > blkEnd[b])
+			blkEnd[b] = rd->regNr + rd->regLen;
+	}
+
+	for (i = 0; i < countRegBlocks; i++)
+	{	// regBlock[] is in address order
+		if (blkFirst[i] < 0)
+			continue;
+
+		planBlock_s_t *pb = &plan->block[plan->countBlocks];
+
+		pb->blkNr = blkFirst[i];
+		pb->blkLen = blkEnd[i] - blkFirst[i];
+		pb->offset = plan->bufLen;
+		plan->bufLen += pb->blkLen;
+		blkMap[i] = plan->countBlocks++;
+	}
+
+	for (i = 0; i < plan->countItems; i++)
+	{
+		planItem_s_t *pi = &plan->item[i];
+		planBlock_s_t *pb = &plan->block[blkMap[pi->rd->regBlock]];
+
+		pi->block = blkMap[pi->rd->regBlock];
+		pi->offset = pb->offset + pi->rd->regNr - pb->blkNr;
+		pb->countItems++;
+	}
+
+	if (verbose > 2)
+	{
+		printf("Read plan '%s': %d registers in %d blocks\n", name, plan->countItems, plan->countBlocks);
+		for (i = 0; i < plan->countBlocks; i++)
+			printf("  Block %d: %04X, %d\n", i, plan->block[i].blkNr, plan->block[i].blkLen);
+	}
+
+	free(blkFirst);
+	free(blkEnd);
+	free(blkMap);
+
+	return plan;
+
+fail:
+	free(blkFirst);
+	free(blkEnd);
+	free(blkMap);
+	freeReadPlan(plan);
+
+	return NULL;
+}	// compileReadPlan
+
+/**********************************************************************
+	Position of register reg in plan, -1 if not part of plan.
+**********************************************************************/
+int findPlanItem(readPlan_s_t *plan, unsigned int reg)
+{
+	for (int i = 0; i < plan->countItems; i++)
+		if (plan->item[i].rd->regNr == reg)
+			return i;
+
+	return(-1);
+}	// findPlanItem
+
+/**********************************************************************
+	Plan reading regs in addition to plan without printing them.
+	Returns plan itself if it already contains all regs.
+**********************************************************************/
+readPlan_s_t *addHiddenRegisters(readPlan_s_t *plan, const unsigned int *regs, int count)
+{
+	unsigned int *all;
+	int n = plan->countItems;
+	readPlan_s_t *hidden;
+
+	if (! (all = malloc((plan->countItems + count) * sizeof(*all))))
+	{
+		printf("addHiddenRegisters malloc failed\n");
+		abort();
+	}
+
+	for (int i = 0; i < plan->countItems; i++)
+		all[i] = plan->item[i].rd->regNr;
+
+	for (int i = 0; i < count; i++)
+	{
+		int j;
+
+		for (j = 0; (j < n) && (all[j] != regs[i]); j++)
+			;
+		if (j == n)
+			all[n++] = regs[i];
+	}
+
+	if (n == plan->countItems)
+	{
+		free(all);
+		return plan;
+	}
+
+	if ((hidden = compileReadPlan(plan->name, plan->layout, all, n)))
+		hidden->countVisible = plan->countVisible;
+
+	free(all);
+
+	return hidden;
+}	// addHiddenRegisters
+
+/**********************************************************************
+	1 if text of len characters contains model name. Only letters and
+	digits are compared, DRS202M is DRS-202M.
+**********************************************************************/
+int modelMatch(const char *name, const char *text, int len)
+{
+	char a[32], b[256];
+	int n = 0;
+
+	for (; *name && (n < sizeof(a) - 1); name++)
+		if (isalnum((unsigned char) *name))
+			a[n++] = toupper((unsigned char) *name);
+	a[n] = '\0';
+
+	for (n = 0; (len-- > 0) && (n < sizeof(b) - 1); text++)
+		if (isalnum((unsigned char) *text))
+			b[n++] = toupper((unsigned char) *text);
+	b[n] = '\0';
+
+	return strstr(b, a) != NULL;
+}	// modelMatch
+
+/**********************************************************************
+	Model of -model name, NULL if unknown. DRT-301C-II is a DRT-301C.
+**********************************************************************/
+const model_s_t *findModel(const char *name)
+{
+	for (int i = 0; models[i].name; i++)
+		if (modelMatch(models[i].name, name, strlen(name)))
+			return &models[i];
+
+	return NULL;
+}	// findModel
+
+/**********************************************************************
+	1 if model has register regNr, every model has all of -regDef
+	that are not listed as absent.
+**********************************************************************/
+int modelHas(const model_s_t *model, unsigned int regNr)
+{
+	if (! model || ! model->absent)
+		return(1);
+
+	for (const uint16_t *r = model->absent; *r; r++)
+		if (*r == regNr)
+			return(0);
+
+	return(1);
+}	// modelHas
+
+/**********************************************************************
+	Items of plan the model has, NULL if all.
+**********************************************************************/
+char *presentItems(readPlan_s_t *plan, const model_s_t *model)
+{
+	char *present;
+	int all = 1;
+
+	for (int i = 0; i < plan->countItems; i++)
+		if (! modelHas(model, plan->item[i].rd->regNr))
+			all = 0;
+
+	if (all)
+		return NULL;
+
+	if (! (present = malloc(plan->countItems)))
+	{
+		printf("presentItems malloc failed\n");
+		abort();
+	}
+
+	for (int i = 0; i < plan->countItems; i++)
+		present[i] = modelHas(model, plan->item[i].rd->regNr);
+
+	return present;
+}	// presentItems
+
+/**********************************************************************
+	Part of block b holding the items the model has: 1 and its range,
+	0 if there are none, -1 if registers it does not have lie between,
+	the items are read one by one then.
+**********************************************************************/
+int blockRange(readPlan_s_t *plan, int b, const model_s_t *model, uint16_t *addr, uint16_t *len)
+{
+	planBlock_s_t *pb = &plan->block[b];
+	int first = -1, end = 0;
+
+	if (! model || ! model->absent)
+	{
+		*addr = pb->blkNr;
+		*len = pb->blkLen;
+		return(1);
+	}
+
+	for (int i = 0; i < plan->countItems; i++)
+	{
+		regDef_s_t *rd = plan->item[i].rd;
+
+		if ((plan->item[i].block != b) || (! modelHas(model, rd->regNr)))
+			continue;
+
+		if ((first < 0) || (rd->regNr < first))
+			first = rd->regNr;
+		if (rd->regNr + rd->regLen > end)
+			end = rd->regNr + rd->regLen;
+	}
+
+	if (first < 0)
+		return(0);
+
+	for (int r = first; r < end; r++)
+		if (! modelHas(model, r))
+			return(-1);
+
+	*addr = first;
+	*len = end - first;
+
+	return(1);
+}	// blockRange
+
+void stampTime(struct timespec *mono, struct timespec *wall);
+
+/**********************************************************************
+	Read all blocks of plan into buf (plan->bufLen registers), only
+	the registers model has. The read of plan->stampItem is timed
+	into clockTime.
+**********************************************************************/
+int executeReadPlan(readPlan_s_t *plan, uint16_t *buf, const model_s_t *model, sampleTime_s_t *clockTime)
+{
+	sampleTime_s_t t;
+
+	for (int b = 0; b < plan->countBlocks; b++)
+	{
+		planBlock_s_t *pb = &plan->block[b];
+		uint16_t addr, len;
+		int range = blockRange(plan, b, model, &addr, &len);
+		char stamp = (plan->stampItem >= 0) && (plan->item[plan->stampItem].block == b);
+
+		if (! range)
+			continue;
+
+		if ((! pb->split) && (range > 0))
+		{
+			stampTime(&t.monoStart, &t.wallStart);
+
+			int rc = ctxRead(addr, len, buf + pb->offset + addr - pb->blkNr);
+
+			stampTime(&t.monoEnd, &t.wallEnd);
+
+			if (rc == len)
+			{
+				if (stamp && clockTime)
+					*clockTime = t;
+				continue;
+			}
+
+			if ((rc == -1) && ((errno == EMBXILADD) || (errno == EMBXILVAL)) && (pb->countItems > 1))
+			{	// meter does not like the coalesced read, remember and fall back to single reads
+				if (verbose > 2)
+					printf("Block %04X, %d rejected: %s - reading registers one by one\n", addr, len, modbus_strerror(errno));
+				pb->split = 1;
+			} else {
+				printf("Read register block %04X, %d failed: %s\n", addr, len, modbus_strerror(errno));
+				return(-1);
+			}
+		}
+
+		for (int i = 0; i < plan->countItems; i++)
+		{
+			planItem_s_t *pi = &plan->item[i];
+
+			if ((pi->block != b) || (! modelHas(model, pi->rd->regNr)))
+				continue;
+
+			stampTime(&t.monoStart, &t.wallStart);
+
+			if (ctxRead(pi->rd->regNr, pi->rd->regLen, buf + pi->offset) == -1)
+			{
+				printf("Read register %04X failed: %s\n", pi->rd->regNr, modbus_strerror(errno));
+				return(-1);
+			}
+
+			stampTime(&t.monoEnd, &t.wallEnd);
+
+			if ((i == plan->stampItem) && clockTime)
+				*clockTime = t;
+		}
+	}
+
+	return(0);
+}	// executeReadPlan
+
+/**********************************************************************
+	Derived metrics, see computeDerived()
+**********************************************************************/
+typedef struct {
+	const char *title;
+	int decimals;
+	const char *unit;
+	char history;			// needs the previous sample
+} derivedMetric_s_t;
+
+const derivedMetric_s_t derivedMetrics[] = {
+	  { "Average Power (Import Energy)",	4, "kW",		1 }
+	, { "Current Imbalance",				1, "%",			0 }
+	, { "Import Energy Rate 1 Delta",		2, "kWh",		1 }
+	, { "Import Energy Rate 2 Delta",		2, "kWh",		1 }
+	, { "Import Energy Rate 3 Delta",		2, "kWh",		1 }
+	, { "Import Energy Rate 4 Delta",		2, "kWh",		1 }
+	, { "Power Factor (P/S)",				3, "cos phi",	0 }
+	, { "Power Factor Deviation",			3, "cos phi",	0 }
+	, { "Apparent Power Mismatch",			1, "%",			0 }
+};
+
+#define countDerived	(int) (sizeof(derivedMetrics) / sizeof(derivedMetrics[0]))
+
+/**********************************************************************
+	Metric i of derivedMetrics[] is output: without -d there is no
+	previous sample.
+**********************************************************************/
+int derivedShown(int i)
+{
+	return optDaemon || (! derivedMetrics[i].history);
+}	// derivedShown
+
+/**********************************************************************
+	Derived values as lines, like printValue() does.
+**********************************************************************/
+void outputDerived(const char *prefix, const double *value)
+{
+	for (int i = 0; i < countDerived; i++)
+		if (derivedShown(i))
+			printValue(prefix, derivedMetrics[i].title, value[i], derivedMetrics[i].decimals, derivedMetrics[i].unit);
+}	// outputDerived
+
+/**********************************************************************
+	Print values read by plan into buf in the layout of the plan,
+	every line starts with prefix. With mask only the visible items
+	set in mask, a csv line is printed complete. Items not present
+	in the meter are left out, "-" in a csv line. derived values of
+	computeDerived() follow the items, as columns of a csv line.
+**********************************************************************/
+void outputReadPlan(readPlan_s_t *plan, uint16_t *buf, const char *prefix, const char *mask, const char *present, const double *derived)
+{
+	int i;
+
+	switch (plan->layout)
+	{
+	case LAYOUT_CSV:
+		if (optTitle && (! plan->headerDone))
+		{
+			for (i = 0; i < plan->countVisible; i++)
+				printf("%s%s", i ? ";" : "", plan->item[i].rd->descStr);
+			for (i = 0; derived && (i < countDerived); i++)
+				if (derivedShown(i))
+					printf(";%s", derivedMetrics[i].title);
+			printf("\n");
+		}
+		plan->headerDone = 1;
+
+		printf("%s", prefix);
+		for (i = 0; i < plan->countVisible; i++)
+		{
+			if (i)
+				printf(";");
+
+			if (present && (! present[i]))
+				printf("-");
+			else
+				printRegister(plan->item[i].rd, buf + plan->item[i].offset, 0, "");
+		}
+		for (i = 0; derived && (i < countDerived); i++)
+		{
+			if (! derivedShown(i))
+				continue;
+
+			if (isnan(derived[i]))
+				printf(";-");
+			else
+				printf(";%.*f", derivedMetrics[i].decimals, derived[i]);
+
+			if (optUnit)
+				printf("%s", derivedMetrics[i].unit);
+		}
+		printf("\n");
+		break;
+
+	case LAYOUT_LINES:
+	default:
+		for (i = 0; i < plan->countVisible; i++)
+		{
+			if ((mask && (! mask[i])) || (present && (! present[i])))
+				continue;
+
+			printf("%s", prefix);
+			printRegister(plan->item[i].rd, buf + plan->item[i].offset, optTitle, "\n");
+		}
+
+		if (derived)
+			outputDerived(prefix, derived);
+		break;
+	}
+}	// outputReadPlan
+
+/**********************************************************************
+**********************************************************************/
+void addReport(readPlan_s_t **list, readPlan_s_t *plan)
+{
+	readPlan_s_t **pp;
+
+	for (pp = list; *pp; pp = &(*pp)->next)
+	{
+		if (strcmp((*pp)->name, plan->name) == 0)
+		{	// replace previous definition
+			plan->next = (*pp)->next;
+			freeReadPlan(*pp);
+			*pp = plan;
+			return;
+		}
+	}
+
+	plan->next = NULL;
+	*pp = plan;
+}	// addReport
+
+/**********************************************************************
+	Find compiled report by name, compile predefined report on first use.
+**********************************************************************/
+readPlan_s_t *findReport(readPlan_s_t **list, const char *name)
+{
+	readPlan_s_t *plan;
+
+	for (plan = *list; plan; plan = plan->next)
+		if (strcmp(plan->name, name) == 0)
+			return plan;
+
+	for (int i = 0; reportDefault[i].name; i++)
+	{
+		if (strcmp(reportDefault[i].name, name) == 0)
+		{
+			unsigned int *regs;
+			int count = parseRegList(reportDefault[i].regs, &regs);
+
+			plan = compileReadPlan(name, reportDefault[i].layout, regs, count);
+			free(regs);
+
+			if (plan)
+				addReport(list, plan);
+
+			return plan;
+		}
+	}
+
+	return NULL;
+}	// findReport
+
+/**********************************************************************
+**********************************************************************/
+struct timeval *msecTimeval(const char *str)
+{
+	char *end;
+	long millis = strtol(str, &end, 0);
+	struct timeval *tv;
+
+	if ((millis <= 0) || *end)
+		return NULL;
+
+	if (! (tv = malloc(sizeof(*tv))))
+	{
+		printf("msecTimeval malloc failed\n");
+		abort();
+	}
+	tv->tv_sec = millis / 1000;
+	tv->tv_usec = (millis % 1000) * 1000;	// micro seconds
+
+	return tv;
+}	// msecTimeval
+
+/**********************************************************************
+**********************************************************************/
+void freeConfig(config_s_t *cfg)
+{
+	readPlan_s_t *plan;
+
+	while ((plan = cfg->reports))
+	{
+		cfg->reports = plan->next;
+		freeReadPlan(plan);
+	}
+
+	free(cfg->device);
+	free(cfg->report);
+	free(cfg->slaves);
+	free(cfg->rollupWindows);
+	free(cfg->responseTimeout);
+	free(cfg->byteTimeout);
+	free(cfg->sink);
+	free(cfg->spool);
+	free(cfg->deadbands);
+	free(cfg->model);
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->staggerUsec = -1;
+}	// freeConfig
+
+/**********************************************************************
+	Load config file into cfg, command line options override it.
+	report <name> <lines|csv> <reg>,<reg>,...
+	poll <report>
+	period <n>|demand
+	device <device>[,<device>...]
+	slaves <addr>,<addr>,...
+	stagger <ms>
+	rollup <window>,<window>,...
+	timeout <response ms> [<byte ms>]
+	output [title] [unit] [timestamp] [derived]
+	sink unix:<path>|tcp:<host>:<port>
+	spool <file>
+	deadband [<reg>=]<band>[%],... [<heartbeat>]
+	demand [<alarm kW>]
+	Returns -1 on any error, cfg has to be freed in any case.
+**********************************************************************/
+int loadConfig(const char *fileName, config_s_t *cfg)
+{
+	FILE *fp = fopen(fileName, "r");
+	char line[1024];
+	int lineNr = 0;
+	int rc = 0;
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->staggerUsec = -1;
+
+	if (! fp)
+	{
+		printf("Open config file '%s' failed: %s\n", fileName, strerror(errno));
+		return(-1);
+	}
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		char *keyword, *arg, *cp;
+
+		lineNr++;
+
+		if ((cp = strchr(line, '#')))
+			*cp = '\0';
+
+		if (! (keyword = strtok(line, " \t\r\n")))
+			continue;
+
+		arg = strtok(NULL, " \t\r\n");
+
+		if (strcmp(keyword, "report") == 0)
+		{
+			char *name = arg;
+			char *layout = strtok(NULL, " \t\r\n");
+			char *regList = strtok(NULL, " \t\r\n");
+			unsigned int *regs;
+			int count;
+			readPlan_s_t *plan;
+
+			if ((! name) || (! layout) || (! regList)
+				|| ((strcmp(layout, "lines") != 0) && (strcmp(layout, "csv") != 0)))
+			{
+				printf("%s:%d: usage: report <name> <lines|csv> <reg>,<reg>,...\n", fileName, lineNr);
+				rc = -1;
+				continue;
+			}
+
+			count = parseRegList(regList, &regs);
+			plan = compileReadPlan(name, (layout[0] == 'c') ? LAYOUT_CSV : LAYOUT_LINES, regs, count);
+			free(regs);
+
+			if (! plan)
+			{
+				printf("%s:%d: report '%s' not compiled\n", fileName, lineNr, name);
+				rc = -1;
+				continue;
+			}
+
+			addReport(&cfg->reports, plan);
+		}
+
+		else if (strcmp(keyword, "poll") == 0)
+		{
+			if (! arg)
+			{
+				printf("%s:%d: usage: poll <report>\n", fileName, lineNr);
+				rc = -1;
+				continue;
+			}
+
+			free(cfg->report);
+			cfg->report = strdup(arg);
+		}
+
+		else if (strcmp(keyword, "period") == 0)
+		{
+			cfg->period = 0;
+			if (arg)
+				cfg->period = (strcmp(arg, "demand") == 0) ? -1 : strtol(arg, NULL, 0);
+
+			if (! cfg->period)
+			{
+				printf("%s:%d: usage: period <n>|demand\n", fileName, lineNr);
+				rc = -1;
+			}
+		}
+
+		else if (strcmp(keyword, "device") == 0)
+		{
+			if (! arg)
+			{
+				printf("%s:%d: usage: device <device>[,<device>...]\n", fileName, lineNr);
+				rc = -1;
+				continue;
+			}
+
+			free(cfg->device);
+			cfg->device = strdup(arg);
+		}
+
+		else if (strcmp(keyword, "slaves") == 0)
+		{
+			unsigned int *list = NULL;
+			int count = arg ? parseRegList(arg, &list) : 0;
+
+			free(cfg->slaves);
+			cfg->slaves = malloc(count + 1);
+			cfg->countSlaves = count;
+
+			for (int j = 0; j < count; j++)
+			{
+				if ((list[j] == 0) || (list[j] > 247))
+					cfg->countSlaves = 0;
+				else
+					cfg->slaves[j] = list[j];
+			}
+			free(list);
+
+			if (! cfg->countSlaves)
+			{
+				printf("%s:%d: usage: slaves <addr>,<addr>,... (1-247)\n", fileName, lineNr);
+				free(cfg->slaves);
+				cfg->slaves = NULL;
+				rc = -1;
+			}
+		}
+
+		else if (strcmp(keyword, "stagger") == 0)
+		{
+			cfg->staggerUsec = arg ? strtol(arg, NULL, 0) * 1000L : -1;
+
+			if (cfg->staggerUsec < 0)
+			{
+				printf("%s:%d: usage: stagger <ms>\n", fileName, lineNr);
+				rc = -1;
+			}
+		}
+
+		else if (strcmp(keyword, "rollup") == 0)
+		{
+			free(cfg->rollupWindows);
+			cfg->countRollups = arg ? parseDurationList(arg, &cfg->rollupWindows) : -1;
+
+			if (cfg->countRollups <= 0)
+			{
+				printf("%s:%d: usage: rollup <window>,<window>,...\n", fileName, lineNr);
+				free(cfg->rollupWindows);
+				cfg->rollupWindows = NULL;
+				cfg->countRollups = 0;
+				rc = -1;
+			}
+		}
+
+		else if (strcmp(keyword, "timeout") == 0)
+		{
+			char *byteArg = strtok(NULL, " \t\r\n");
+
+			free(cfg->responseTimeout);
+			free(cfg->byteTimeout);
+			cfg->responseTimeout = arg ? msecTimeval(arg) : NULL;
+			cfg->byteTimeout = byteArg ? msecTimeval(byteArg) : NULL;
+
+			if ((! cfg->responseTimeout) || (byteArg && (! cfg->byteTimeout)))
+			{
+				printf("%s:%d: usage: timeout <response ms> [<byte ms>]\n", fileName, lineNr);
+				rc = -1;
+			}
+		}
+
+		else if (strcmp(keyword, "model") == 0)
+		{
+			if ((! arg) || ((strcmp(arg, "auto") != 0) && (! findModel(arg))))
+			{
+				printf("%s:%d: usage: model auto|<model>, e.g. DRS-202M\n", fileName, lineNr);
+				rc = -1;
+				continue;
+			}
+
+			free(cfg->model);
+			cfg->model = strdup(arg);
+		}
+
+		else if (strcmp(keyword, "demand") == 0)
+		{
+			cfg->demand = 1;
+			cfg->demandAlarm = arg ? strtod(arg, NULL) : 0;
+
+			if (cfg->demandAlarm < 0)
+			{
+				printf("%s:%d: usage: demand [<alarm kW>]\n", fileName, lineNr);
+				cfg->demand = 0;
+				rc = -1;
+			}
+		}
+
+		else if (strcmp(keyword, "deadband") == 0)
+		{
+			char *heartbeat = strtok(NULL, " \t\r\n");
+
+			free(cfg->deadbands);
+			cfg->countDeadbands = arg ? parseDeadbands(arg, &cfg->deadbands) : -1;
+			cfg->heartbeat = heartbeat ? parseDuration(heartbeat) : 0;
+
+			if ((cfg->countDeadbands <= 0) || (cfg->heartbeat < 0))
+			{
+				printf("%s:%d: usage: deadband [reg=]band[%%],... [heartbeat]\n", fileName, lineNr);
+				cfg->countDeadbands = 0;
+				cfg->heartbeat = 0;
+				rc = -1;
+			}
+		}
+
+		else if ((strcmp(keyword, "sink") == 0) || (strcmp(keyword, "spool") == 0))
+		{
+			char **target = (keyword[1] == 'i') ? &cfg->sink : &cfg->spool;
+
+			if (! arg)
+			{
+				printf("%s:%d: usage: sink unix:<path>|tcp:<host>:<port>, spool <file>\n", fileName, lineNr);
+				rc = -1;
+				continue;
+			}
+
+			free(*target);
+			*target = strdup(arg);
+		}
+
+		else if (strcmp(keyword, "output") == 0)
+		{
+			for (; arg; arg = strtok(NULL, " \t\r\n"))
+			{
+				if (strcmp(arg, "title") == 0)
+					cfg->title = 1;
+				else if (strcmp(arg, "unit") == 0)
+					cfg->unit = 1;
+				else if (strcmp(arg, "timestamp") == 0)
+					cfg->timestamp = 1;
+				else if (strcmp(arg, "derived") == 0)
+					cfg->derived = 1;
+				else
+				{
+					printf("%s:%d: usage: output [title] [unit] [timestamp] [derived]\n", fileName, lineNr);
+					rc = -1;
+				}
+			}
+		}
+
+		else
+		{
+			printf("%s:%d: unknown keyword '%s'\n", fileName, lineNr, keyword);
+			rc = -1;
+		}
+	}
+
+	fclose(fp);
+
+	return(rc);
+}	// loadConfig
+
+/**********************************************************************
+	Effective options: command line if given, else config file.
+**********************************************************************/
+void applyConfig(config_s_t *cfg)
+{
+	static uint8_t defaultSlaves[] = { defaultSlaveAddress };
+
+	optReport = (cmdline.report || optRegsToDump) ? cmdline.report : cfg->report;
+	optDaemon = cmdline.period ? cmdline.period : cfg->period;
+	optStaggerUsec = (cmdline.staggerUsec >= 0) ? cmdline.staggerUsec : cfg->staggerUsec;
+
+	if (cmdline.slaves)
+	{
+		slaveList = cmdline.slaves;
+		countSlaves = cmdline.countSlaves;
+	}
+	else if (cfg->slaves)
+	{
+		slaveList = cfg->slaves;
+		countSlaves = cfg->countSlaves;
+	}
+	else
+	{
+		slaveList = defaultSlaves;
+		countSlaves = 1;
+	}
+	slaveAddress = slaveList[0];
+
+	if (cmdline.rollupWindows)
+	{
+		rollupWindows = cmdline.rollupWindows;
+		countRollups = cmdline.countRollups;
+	}
+	else
+	{
+		rollupWindows = cfg->rollupWindows;
+		countRollups = cfg->countRollups;
+	}
+
+	optResponseTimeout = cmdline.responseTimeout ? cmdline.responseTimeout : cfg->responseTimeout;
+	optByteTimeout = cmdline.byteTimeout ? cmdline.byteTimeout : cfg->byteTimeout;
+
+	optTitle = cmdline.title || cfg->title;
+	optUnit = cmdline.unit || cfg->unit;
+	optTimestamp = cmdline.timestamp || cfg->timestamp;
+	optDerived = cmdline.derived || cfg->derived;
+	optSink = cmdline.sink ? cmdline.sink : cfg->sink;
+	optSpool = cmdline.spool ? cmdline.spool : cfg->spool;
+
+	if (cmdline.deadbands)
+	{
+		deadbands = cmdline.deadbands;
+		countDeadbands = cmdline.countDeadbands;
+	}
+	else
+	{
+		deadbands = cfg->deadbands;
+		countDeadbands = cfg->countDeadbands;
+	}
+
+	optHeartbeat = cmdline.heartbeat ? cmdline.heartbeat : cfg->heartbeat ? cfg->heartbeat : defaultHeartbeat;
+	optDemand = cmdline.demand || cfg->demand;
+	optDemandAlarm = cmdline.demand ? cmdline.demandAlarm : cfg->demandAlarm;
+	optModel = cmdline.model ? cmdline.model : cfg->model;
+}	// applyConfig
+
+/**********************************************************************
+	Time to transmit len characters with the serial parameters.
+**********************************************************************/
+long frameUsec(int len)
+{
+	int bits = 1 + serialDataBits + (serialParity != 'N') + serialStopBits;
+
+	return 1000000L * bits * len / serialBaud;
+}	// frameUsec
+
+/**********************************************************************
+	Non-blocking RTU transport
+	Any number of serial buses driven from one epoll loop. Each bus
+	handles one transaction at a time, frames are separated by the
+	3.5 character silence and checked by CRC. Transactions read
+	(function 0x03) or write (0x10) holding registers, frames are
+	built and checked by libmbc.
+**********************************************************************/
+void stampTime(struct timespec *mono, struct timespec *wall)
+{
+	clock_gettime(CLOCK_MONOTONIC, mono);
+	clock_gettime(CLOCK_REALTIME, wall);
+}	// stampTime
+
+/**********************************************************************
+**********************************************************************/
+void rtuArmTimer(rtuBus_s_t *bus, long usec)
+{
+	struct itimerspec its = { { 0, 0 }, { usec / 1000000, (usec % 1000000) * 1000 } };
+
+	if (usec <= 0)
+		its.it_value.tv_nsec = 1;	// zero would disarm
+
+	timerfd_settime(bus->timerFd, 0, &its, NULL);
+}	// rtuArmTimer
+
+/**********************************************************************
+**********************************************************************/
+long responseTimeoutUsec(void)
+{
+	if (optResponseTimeout)
+		return optResponseTimeout->tv_sec * 1000000L + optResponseTimeout->tv_usec;
+
+	return 500000;		// libmodbus default
+}	// responseTimeoutUsec
+
+/**********************************************************************
+**********************************************************************/
+long byteTimeoutUsec(void)
+{
+	if (optByteTimeout)
+		return optByteTimeout->tv_sec * 1000000L + optByteTimeout->tv_usec;
+
+	return 500000;		// libmodbus default
+}	// byteTimeoutUsec
+
+/**********************************************************************
+	Read len registers at addr over ctx: libmbc on the fd libmodbus
+	opened, slave of modbus_set_slave(), timeouts of -rt and -bt.
+	Returns len or -1 like modbus_read_registers().
+**********************************************************************/
+int ctxRead(uint16_t addr, int len, uint16_t *dest)
+{
+	int slave = modbus_get_slave(ctx);
+	int rc;
+
+	ctxBus.fd = modbus_get_socket(ctx);		// changes with reconnect
+	ctxBus.responseUsec = responseTimeoutUsec();
+	ctxBus.byteUsec = byteTimeoutUsec();
+
+	rc = mbc_read(&ctxBus, slave, addr, len, dest);
+
+	if (verbose > 2)
+		printf("MBC %s slave %d %04X, %d: %s\n", serialDevice, slave, addr, len, (rc == -1) ? modbus_strerror(errno) : "ok");
+
+	return rc;
+}	// ctxRead
+
+/**********************************************************************
+	Open serial device in non-blocking raw mode, fd or -1.
+**********************************************************************/
+int rtuOpenDevice(const char *device, int baud, char parity, int dataBits, int stopBits)
+{
+	mbc_bus_t io;
+
+	if (mbc_open(&io, device, baud, parity, dataBits, stopBits) < 0)
+	{
+		printf("Open %s failed: %s\n", device, strerror(errno));
+		return(-1);
+	}
+
+	return(io.fd);
+}	// rtuOpenDevice
+
+/**********************************************************************
+	Open serial device in non-blocking mode and register it with epoll.
+**********************************************************************/
+rtuBus_s_t *rtuOpen(const char *device, int baud, char parity, int dataBits, int stopBits)
+{
+	rtuBus_s_t *bus;
+
+	if (epollFd < 0)
+	{
+		if ((epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		{
+			printf("epoll_create failed: %s\n", strerror(errno));
+			return NULL;
+		}
+	}
+
+	if (! (bus = calloc(1, sizeof(*bus))))
+	{
+		printf("rtuOpen malloc failed\n");
+		abort();
+	}
+
+	bus->device = strdup(device);
+	bus->fd = rtuOpenDevice(device, baud, parity, dataBits, stopBits);
+	if (bus->fd < 0)
+	{
+		free(bus->device);
+		free(bus);
+		return NULL;
+	}
+
+	// 1 start, data, parity, stop bits per character
+	int bits = 1 + dataBits + (parity != 'N') + stopBits;
+	bus->t35Usec = (baud > 19200) ? 1750 : 3500000L * bits / baud;
+
+	if ((bus->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+	{
+		printf("timerfd_create %s failed: %s\n", device, strerror(errno));
+		goto fail;
+	}
+	bus->evFd.bus = bus;
+	bus->evTimer.bus = bus;
+	bus->evTimer.isTimer = 1;
+
+	struct epoll_event ev = { .events = EPOLLIN };
+	ev.data.ptr = &bus->evFd;
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, bus->fd, &ev) < 0)
+	{
+		printf("epoll_ctl %s failed: %s\n", device, strerror(errno));
+		goto fail;
+	}
+	ev.data.ptr = &bus->evTimer;
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, bus->timerFd, &ev) < 0)
+	{
+		printf("epoll_ctl %s timer failed: %s\n", device, strerror(errno));
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, bus->fd, NULL);
+		goto fail;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &bus->lastIO);
+	bus->state = RTU_IDLE;
+
+	if (verbose > 2)
+		printf("RTU bus %s: %d,%d,%c,%d t3.5 %ldus\n", device, baud, dataBits, parity, stopBits, bus->t35Usec);
+
+	return bus;
+
+fail:
+	if (bus->timerFd >= 0)
+		close(bus->timerFd);
+	close(bus->fd);
+	free(bus->device);
+	free(bus);
+
+	return NULL;
+}	// rtuOpen
+
+/**********************************************************************
+**********************************************************************/
+void rtuClose(rtuBus_s_t *bus)
+{
+	if (! bus)
+		return;
+
+	if (bus->fd >= 0)
+	{
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, bus->fd, NULL);
+		close(bus->fd);
+	}
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, bus->timerFd, NULL);
+	close(bus->timerFd);
+	free(bus->device);
+	free(bus);
+}	// rtuClose
+
+void rtuStart(rtuBus_s_t *bus);
+void rtuGone(rtuBus_s_t *bus, int err);
+
+/**********************************************************************
+	Finish transaction in flight and start next one after silence.
+**********************************************************************/
+void rtuComplete(rtuBus_s_t *bus, int err)
+{
+	rtuTrans_s_t *t = bus->head;
+
+	bus->head = t->next;
+	if (! bus->head)
+		bus->tail = NULL;
+
+	t->rc = err ? -1 : 0;
+	t->err = err;
+	stampTime(&t->time.monoEnd, &t->time.wallEnd);
+	bus->state = RTU_IDLE;
+	bus->rspLen = 0;
+	rtuPending--;
+
+	if (verbose > 2)
+		printf("RTU %s slave %d %04X, %d: %s\n", bus->device, t->slave, t->addr, t->len, err ? modbus_strerror(err) : "ok");
+
+	if (t->done)
+		t->done(t);		// may submit new transactions
+
+	if (bus->head && (bus->state == RTU_IDLE))
+		rtuStart(bus);
+}	// rtuComplete
+
+/**********************************************************************
+	Send request of head transaction, respecting inter frame silence.
+**********************************************************************/
+void rtuStart(rtuBus_s_t *bus)
+{
+	rtuTrans_s_t *t = bus->head;
+	long silence = mbc_usec_since(&bus->lastIO);
+
+	if (bus->dead)
+	{
+		rtuComplete(bus, ENODEV);
+		return;
+	}
+
+	if (silence < bus->t35Usec)
+	{
+		bus->state = RTU_SILENCE;
+		rtuArmTimer(bus, bus->t35Usec - silence);
+		return;
+	}
+
+	uint8_t *req = bus->req;
+	int reqLen = mbc_request(req, t->slave, t->addr, t->len, t->src);
+
+	tcflush(bus->fd, TCIFLUSH);		// drop garbage from previous frames
+
+	stampTime(&t->time.monoStart, &t->time.wallStart);
+	if (write(bus->fd, req, reqLen) != reqLen)
+	{
+		if ((errno == EIO) || (errno == ENXIO) || (errno == ENODEV))
+			rtuGone(bus, errno);
+		else
+			rtuComplete(bus, errno ? errno : EIO);
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &bus->lastIO);
+	bus->rspLen = 0;
+	bus->expLen = mbc_expected(req, bus->rsp, 0);
+	bus->state = RTU_RECEIVING;
+
+	if (t->slave == MODBUS_BROADCAST_ADDRESS)
+	{	// no response, done when the slaves had time to process the frame
+		rtuArmTimer(bus, reqLen * bus->t35Usec * 2 / 7 + defaultTurnaroundUsec);
+		return;
+	}
+
+	// the request itself needs reqLen characters on the line
+	rtuArmTimer(bus, reqLen * bus->t35Usec * 2 / 7 + responseTimeoutUsec());
+}	// rtuStart
+
+/**********************************************************************
+**********************************************************************/
+void rtuSubmit(rtuBus_s_t *bus, rtuTrans_s_t *t)
+{
+	t->next = NULL;
+	t->rc = -1;
+	t->err = 0;
+
+	if (bus->tail)
+		bus->tail->next = t;
+	else
+		bus->head = t;
+	bus->tail = t;
+
+	rtuPending++;
+
+	if (bus->state == RTU_IDLE && bus->head == t)
+		rtuStart(bus);
+}	// rtuSubmit
+
+/**********************************************************************
+	Device unplugged: close it and fail the transaction in flight and
+	all queued ones. The daemon reconnects with rtuReconnect().
+**********************************************************************/
+void rtuGone(rtuBus_s_t *bus, int err)
+{
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+	if (bus->dead)
+		return;
+
+	printf("Device %s gone: %s\n", bus->device, strerror(err));
+
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, bus->fd, NULL);
+	close(bus->fd);
+	bus->fd = -1;
+	bus->dead = 1;
+
+	timerfd_settime(bus->timerFd, 0, &its, NULL);
+	if (bus->head)
+		rtuComplete(bus, ENODEV);	// the following ones fail in rtuStart()
+}	// rtuGone
+
+/**********************************************************************
+	Reopen device of a gone bus, 0 if back.
+**********************************************************************/
+int rtuReconnect(rtuBus_s_t *bus)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+
+	if ((bus->fd = rtuOpenDevice(bus->device, serialBaud, serialParity, serialDataBits, serialStopBits)) < 0)
+		return(-1);
+
+	ev.data.ptr = &bus->evFd;
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, bus->fd, &ev) < 0)
+	{
+		printf("epoll_ctl %s failed: %s\n", bus->device, strerror(errno));
+		close(bus->fd);
+		bus->fd = -1;
+		return(-1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &bus->lastIO);
+	bus->state = RTU_IDLE;
+	bus->rspLen = 0;
+	bus->dead = 0;
+
+	return(0);
+}	// rtuReconnect
+
+/**********************************************************************
+**********************************************************************/
+void rtuReceive(rtuBus_s_t *bus)
+{
+	int n;
+
+	while ((n = read(bus->fd, bus->rsp + bus->rspLen, sizeof(bus->rsp) - bus->rspLen)) > 0)
+	{
+		bus->rspLen += n;
+		clock_gettime(CLOCK_MONOTONIC, &bus->lastIO);
+	}
+
+	if ((n == 0) || ((n < 0) && (errno != EAGAIN)))
+	{	// device gone, hangup would be reported again and again
+		rtuGone(bus, (n < 0) ? errno : EIO);
+		return;
+	}
+
+	if (bus->state != RTU_RECEIVING)
+	{	// unsolicited bytes, only restart silence
+		bus->rspLen = 0;
+		return;
+	}
+
+	rtuTrans_s_t *t = bus->head;
+
+	if (t->slave == MODBUS_BROADCAST_ADDRESS)
+	{	// nobody answers a broadcast
+		bus->rspLen = 0;
+		return;
+	}
+
+	bus->expLen = mbc_expected(bus->req, bus->rsp, bus->rspLen);
+
+	if (bus->rspLen < bus->expLen)
+	{	// wait for next byte
+		rtuArmTimer(bus, byteTimeoutUsec());
+		return;
+	}
+
+	rtuComplete(bus, mbc_response(bus->req, bus->rsp, bus->expLen, t->dest));
+}	// rtuReceive
+
+/**********************************************************************
+**********************************************************************/
+void rtuTimer(rtuBus_s_t *bus)
+{
+	uint64_t expirations;
+
+	if (read(bus->timerFd, &expirations, sizeof(expirations)) < 0)
+		return;		// disarmed or re-armed meanwhile
+
+	switch (bus->state)
+	{
+	case RTU_SILENCE:
+		bus->state = RTU_IDLE;
+		rtuStart(bus);
+		break;
+	case RTU_RECEIVING:
+		if (bus->head->slave == MODBUS_BROADCAST_ADDRESS)
+			rtuComplete(bus, 0);
+		else
+			rtuComplete(bus, bus->rspLen ? EMBBADDATA : ETIMEDOUT);
+		break;
+	default:
+		break;
+	}
+}	// rtuTimer
+
+/**********************************************************************
+	Dispatch events until all submitted transactions are done.
+**********************************************************************/
+int rtuRun(void)
+{
+	struct epoll_event ev[16];
+
+	while (rtuPending > 0)
+	{
+		int n = epoll_wait(epollFd, ev, 16, -1);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			printf("epoll_wait failed: %s\n", strerror(errno));
+			return(-1);
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			rtuEvent_s_t *e = ev[i].data.ptr;
+
+			if (e->isTimer)
+				rtuTimer(e->bus);
+			else
+				rtuReceive(e->bus);
+		}
+	}
+
+	return(0);
+}	// rtuRun
+
+/**********************************************************************
+	Read plan over non-blocking transport: one transaction per block,
+	all blocks of all buses in flight concurrently.
+**********************************************************************/
+void planTransDone(rtuTrans_s_t *t)
+{
+	planRun_s_t *run = t->arg;
+	readPlan_s_t *plan = run->plan;
+	int b = t - run->trans;
+
+	if (--run->outstanding == 0 && run->time)
+		stampTime(&run->time->monoEnd, &run->time->wallEnd);
+
+	if ((! t->rc) && (plan->stampItem >= 0) && run->clockTime
+		&& ((b < plan->countBlocks) ? (plan->item[plan->stampItem].block == b) : (b - plan->countBlocks == plan->stampItem)))
+		*run->clockTime = t->time;
+
+	if (! t->rc)
+		return;
+
+	if ((b < plan->countBlocks) && ((t->err == EMBXILADD) || (t->err == EMBXILVAL)) && (plan->block[b].countItems > 1))
+	{	// meter does not like the coalesced read, remember and fall back to single reads
+		if (verbose > 2)
+			printf("Block %04X, %d rejected: %s - reading registers one by one\n", t->addr, t->len, modbus_strerror(t->err));
+
+		plan->block[b].split = 1;
+
+		for (int i = 0; i < plan->countItems; i++)
+		{
+			if ((plan->item[i].block == b) && modelHas(run->model, plan->item[i].rd->regNr))
+			{
+				run->outstanding++;
+				rtuSubmit(run->bus, &run->trans[plan->countBlocks + i]);
+			}
+		}
+		return;
+	}
+
+	if (! run->bus->dead)		// reported once by rtuGone()
+		printf("%s: read register %04X, %d failed: %s\n", run->bus->device, t->addr, t->len, modbus_strerror(t->err));
+	run->failed++;
+}	// planTransDone
+
+/**********************************************************************
+**********************************************************************/
+planRun_s_t *newPlanRun(readPlan_s_t *plan, rtuBus_s_t *bus, uint8_t slave, const model_s_t *model)
+{
+	planRun_s_t *run = calloc(1, sizeof(*run));
+
+	if ((! run)
+		|| (! (run->buf = calloc(plan->bufLen, sizeof(*run->buf))))
+		|| (! (run->trans = calloc(plan->countBlocks + plan->countItems, sizeof(*run->trans)))))
+	{
+		printf("newPlanRun malloc failed\n");
+		abort();
+	}
+
+	run->plan = plan;
+	run->bus = bus;
+	run->slave = slave;
+	run->model = model;
+
+	for (int b = 0; b < plan->countBlocks; b++)
+	{
+		rtuTrans_s_t *t = &run->trans[b];
+
+		t->slave = slave;
+		if (blockRange(plan, b, model, &t->addr, &t->len) > 0)		// else len 0: present items one by one
+			t->dest = run->buf + plan->block[b].offset + t->addr - plan->block[b].blkNr;
+		else
+			t->len = 0;
+	}
+
+	for (int i = 0; i < plan->countItems; i++)
+	{
+		rtuTrans_s_t *t = &run->trans[plan->countBlocks + i];
+
+		t->slave = slave;
+		t->addr = plan->item[i].rd->regNr;
+		t->len = plan->item[i].rd->regLen;
+		t->dest = run->buf + plan->item[i].offset;
+	}
+
+	for (int i = 0; i < plan->countBlocks + plan->countItems; i++)
+	{
+		run->trans[i].done = planTransDone;
+		run->trans[i].arg = run;
+	}
+
+	return run;
+}	// newPlanRun
+
+/**********************************************************************
+	Queue all transactions of a plan run, rtuRun() does the work.
+**********************************************************************/
+void submitPlanRun(planRun_s_t *run)
+{
+	readPlan_s_t *plan = run->plan;
+
+	run->failed = 0;
+	run->outstanding = 1;		// keep completion from firing while submitting
+
+	for (int b = 0; b < plan->countBlocks; b++)
+	{
+		if ((! plan->block[b].split) && run->trans[b].len)
+		{
+			run->outstanding++;
+			rtuSubmit(run->bus, &run->trans[b]);
+			continue;
+		}
+
+		for (int i = 0; i < plan->countItems; i++)
+		{
+			if ((plan->item[i].block == b) && modelHas(run->model, plan->item[i].rd->regNr))
+			{
+				run->outstanding++;
+				rtuSubmit(run->bus, &run->trans[plan->countBlocks + i]);
+			}
+		}
+	}
+	if (--run->outstanding == 0 && run->time)
+		stampTime(&run->time->monoEnd, &run->time->wallEnd);
+}	// submitPlanRun
+
+/**********************************************************************
+	Meters: every slave address of -sa on every device of -i
+**********************************************************************/
+void appendMeter(meter_s_t *m)
+{
+	meter_s_t **mp;
+
+	m->busIndex = 0;
+	m->next = NULL;
+
+	for (mp = &meters; *mp; mp = &(*mp)->next)
+		if ((*mp)->bus == m->bus)
+			m->busIndex++;
+	*mp = m;
+	countMeters++;
+}	// appendMeter
+
+/**********************************************************************
+**********************************************************************/
+meter_s_t *addMeter(rtuBus_s_t *bus, uint8_t slave, const char *device, char prefixed)
+{
+	meter_s_t *m = calloc(1, sizeof(*m));
+	char name[256];
+
+	if (! m)
+	{
+		printf("addMeter malloc failed\n");
+		abort();
+	}
+
+	if (prefixed)
+		snprintf(name, sizeof(name), "%s:%d", device, slave);
+	else
+		snprintf(name, sizeof(name), "%d", slave);
+
+	m->name = strdup(name);
+	m->device = strdup(device);
+	m->bus = bus;
+	m->slave = slave;
+
+	appendMeter(m);
+
+	return m;
+}	// addMeter
+
+/**********************************************************************
+**********************************************************************/
+void freeMeter(meter_s_t *m)
+{
+	if (m->run)
+	{
+		free(m->run->buf);
+		free(m->run->trans);
+		free(m->run);
+	}
+	free(m->buf);
+	free(m->rollup);
+	free(m->rollupStart);
+	free(m->emitBuf);
+	free(m->emitTime);
+	free(m->emitted);
+	free(m->demand.slideEnergy);
+	free(m->cache);
+	free(m->cacheTime);
+	free(m->tryTime);
+	free(m->writeAddr);
+	free(m->writeValue);
+	free(m->present);
+	free(m->name);
+	free(m->device);
+	free(m);
+}	// freeMeter
+
+/**********************************************************************
+	Meters for slaveList on all buses. Meters already polled keep their
+	buffers and state, the buses are not touched. Reading -cache only,
+	-i lists the devices of the -d -nb writing it, none is opened.
+**********************************************************************/
+void syncMeters(void)
+{
+	meter_s_t *old = meters;
+	meter_s_t *m, **mp;
+	char *list = strdup(serialDevice);
+	char *device[countBuses + strlen(serialDevice) + 1];
+	int countDevices = 0;
+
+	if (! list)
+	{
+		printf("syncMeters malloc failed\n");
+		abort();
+	}
+
+	if (countBuses)
+		for (int b = 0; b < countBuses; b++)
+			device[countDevices++] = buses[b]->device;
+	else if (optCacheFile && (! optDaemon))
+		for (char *dev = strtok(list, ","); dev; dev = strtok(NULL, ","))
+			device[countDevices++] = dev;
+	else
+		device[countDevices++] = serialDevice;
+
+	meters = NULL;
+	countMeters = 0;
+
+	for (int b = 0; b < countDevices; b++)
+	{
+		rtuBus_s_t *bus = countBuses ? buses[b] : NULL;
+
+		for (int j = 0; j < countSlaves; j++)
+		{
+			for (mp = &old; *mp && (((*mp)->bus != bus) || strcmp((*mp)->device, device[b])
+				|| ((*mp)->slave != slaveList[j])); mp = &(*mp)->next)
+				;
+
+			if ((m = *mp))
+			{
+				*mp = m->next;
+				appendMeter(m);
+			}
+			else
+				addMeter(bus, slaveList[j], device[b], countDevices > 1);
+		}
+	}
+
+	while ((m = old))
+	{
+		old = m->next;
+		freeMeter(m);
+	}
+	free(list);
+}	// syncMeters
+
+/**********************************************************************
+	Drop open rollup windows, restarted with next sample.
+**********************************************************************/
+void resetRollups(meter_s_t *m)
+{
+	free(m->rollup);
+	free(m->rollupStart);
+	m->rollup = NULL;
+	m->rollupStart = NULL;
+}	// resetRollups
+
+/**********************************************************************
+	Forget values last emitted with -deadband, next sample is complete.
+**********************************************************************/
+void resetEmitted(meter_s_t *m)
+{
+	free(m->emitBuf);
+	free(m->emitTime);
+	free(m->emitted);
+	m->emitBuf = NULL;
+	m->emitTime = NULL;
+	m->emitted = NULL;
+}	// resetEmitted
+
+/**********************************************************************
+	Bind meter buffers to plan, only allocates if plan changed. NULL unbinds.
+**********************************************************************/
+void bindMeter(meter_s_t *m, readPlan_s_t *plan)
+{
+	if (m->plan == plan)
+		return;
+
+	if (m->run)
+	{
+		free(m->run->buf);
+		free(m->run->trans);
+		free(m->run);
+		m->run = NULL;
+	}
+	free(m->buf);
+	m->buf = NULL;
+	free(m->present);
+	m->present = NULL;
+	resetRollups(m);
+	resetEmitted(m);
+
+	m->plan = plan;
+
+	if (! plan)
+		return;
+
+	m->present = presentItems(plan, m->model);
+
+	if (m->bus)
+	{
+		m->run = newPlanRun(plan, m->bus, m->slave, m->model);
+		m->run->time = &m->time;
+		m->run->clockTime = &m->clockTime;
+	}
+	else if (! (m->buf = calloc(plan->bufLen, sizeof(*m->buf))))
+	{
+		printf("bindMeter malloc failed\n");
+		abort();
+	}
+}	// bindMeter
+
+/**********************************************************************
+**********************************************************************/
+uint16_t *meterBuf(meter_s_t *m)
+{
+	return m->run ? m->run->buf : m->buf;
+}	// meterBuf
+
+/**********************************************************************
+	Execute plan on count meters of due[], concurrently with -nb.
+	Returns number of failed meters.
+**********************************************************************/
+int pollMeters(readPlan_s_t *plan, meter_s_t **due, int count)
+{
+	int failed = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		meter_s_t *m = due[i];
+
+		bindMeter(m, plan);
+		stampTime(&m->time.monoStart, &m->time.wallStart);
+
+		if (m->run)
+		{
+			submitPlanRun(m->run);
+			continue;
+		}
+
+		if (ctxDead)
+		{	// reconnect pending
+			m->failed = -1;
+			m->time.monoEnd = m->time.monoStart;
+			m->time.wallEnd = m->time.wallStart;
+			continue;
+		}
+
+		modbus_set_slave(ctx, m->slave);
+		m->failed = executeReadPlan(plan, m->buf, m->model, &m->clockTime);
+		stampTime(&m->time.monoEnd, &m->time.wallEnd);
+	}
+
+	if (optNonBlocking && rtuRun())
+		return count;
+
+	for (int i = 0; i < count; i++)
+	{
+		if (due[i]->run)
+			due[i]->failed = due[i]->run->failed;
+
+		if (due[i]->failed)
+			failed++;
+
+		if (verbose > 1)
+			printf("Sample %s: %ld.%03ld - %ld.%03ld, %ldms%s\n", due[i]->name,
+				due[i]->time.wallStart.tv_sec, due[i]->time.wallStart.tv_nsec / 1000000,
+				due[i]->time.wallEnd.tv_sec, due[i]->time.wallEnd.tv_nsec / 1000000,
+				((due[i]->time.monoEnd.tv_sec - due[i]->time.monoStart.tv_sec) * 1000000000L
+					+ due[i]->time.monoEnd.tv_nsec - due[i]->time.monoStart.tv_nsec) / 1000000,
+				due[i]->failed ? " failed" : "");
+	}
+
+	return failed;
+}	// pollMeters
+
+/**********************************************************************
+	Read len registers at addr from meter, over the meter's transport.
+**********************************************************************/
+int readMeterRegisters(meter_s_t *m, uint16_t addr, int len, uint16_t *dest)
+{
+	if (m->bus)
+	{
+		rtuTrans_s_t t = { .slave = m->slave, .addr = addr, .len = len, .dest = dest };
+
+		rtuSubmit(m->bus, &t);
+		if (rtuRun() || t.rc)
+		{
+			errno = t.err;
+			return(-1);
+		}
+		return len;
+	}
+
+	modbus_set_slave(ctx, m->slave);
+	return ctxRead(addr, len, dest);
+}	// readMeterRegisters
+
+/**********************************************************************
+	-model auto: Report Slave ID (0x11, not over -nb) if the meter
+	names itself, else single phase if Voltage L2 is rejected.
+	NULL if the meter does not answer.
+**********************************************************************/
+const model_s_t *detectModel(meter_s_t *m)
+{
+	uint8_t id[MODBUS_MAX_PDU_LENGTH];
+	uint16_t dest[2];
+	int rc;
+
+	if (! m->bus)
+	{	// slave id, run indicator, text
+		modbus_set_slave(ctx, m->slave);
+		rc = modbus_report_slave_id(ctx, sizeof(id), id);
+
+		for (int i = 0; (rc > 2) && models[i].name; i++)
+			if (modelMatch(models[i].name, (char *) id + 2, ((rc < sizeof(id)) ? rc : sizeof(id)) - 2))
+				return &models[i];
+
+		if (verbose > 2)
+			printf("%s: Report Slave ID %s\n", m->name, (rc < 0) ? modbus_strerror(errno) : "unknown");
+
+		if (rc < 0)
+			modbus_flush(ctx);		// rest of a response libmodbus did not understand
+	}
+
+	if (readMeterRegisters(m, 0x0012, 2, dest) == 2)
+		return findModel("DRT-301M");
+
+	if ((errno == EMBXILADD) || (errno == EMBXILVAL))
+		return findModel("DRS-202M");
+
+	printf("%s: model not detected: %s\n", m->name, modbus_strerror(errno));
+
+	return NULL;
+}	// detectModel
+
+/**********************************************************************
+	Set model of meters from -model, detect for auto once per meter.
+	Meters with a new model are bound again with the next poll.
+**********************************************************************/
+void setupModels(void)
+{
+	for (meter_s_t *m = meters; m; m = m->next)
+	{
+		const model_s_t *model = NULL;
+		char detect = optModel && (strcmp(optModel, "auto") == 0);
+
+		if (! detect)
+		{
+			model = optModel ? findModel(optModel) : NULL;
+			m->modelDetected = 0;
+		}
+		else if (m->modelDetected)
+			model = m->model;
+		else if (m->bus ? (! m->bus->dead) : (ctx && ! ctxDead))
+		{
+			model = detectModel(m);
+			m->modelDetected = (model != NULL);
+
+			if (model && verbose)
+				printf("%s: model %s\n", m->name, model->name);
+		}
+
+		if (model != m->model)
+		{
+			m->model = model;
+			bindMeter(m, NULL);
+		}
+	}
+}	// setupModels
+
+/**********************************************************************
+	Low latency serial
+	USB adapters hold received bytes until their latency timer expires,
+	FTDI chips 16 ms by default, which is added to every response. The
+	timer is in sysfs of the usb-serial device behind the tty.
+**********************************************************************/
+int setLatencyTimer(const char *device, int ms)
+{
+	char real[PATH_MAX];
+	char path[PATH_MAX + 64];
+	int old = -1;
+	FILE *fp;
+
+	if (! realpath(device, real))
+		return(-1);
+
+	snprintf(path, sizeof(path), "/sys/bus/usb-serial/devices/%s/latency_timer", basename(real));
+
+	if (! (fp = fopen(path, "r+")))
+		return(-1);
+
+	if ((fscanf(fp, "%d", &old) != 1) || (fseek(fp, 0, SEEK_SET) < 0) || (fprintf(fp, "%d\n", ms) < 0))
+		old = -1;
+
+	if (fclose(fp))
+		old = -1;
+
+	return(old);
+}	// setLatencyTimer
+
+/**********************************************************************
+	-lowLatency: ASYNC_LOW_LATENCY and latency timer, -rs485: kernel
+	direction control, RTS on while sending. Returns settings applied.
+**********************************************************************/
+int lowLatencySerial(int fd, const char *device)
+{
+	int applied = 0;
+
+	if (optLowLatency)
+	{
+		struct serial_struct ss;
+		int old;
+
+		if ((ioctl(fd, TIOCGSERIAL, &ss) < 0)
+			|| (ss.flags |= ASYNC_LOW_LATENCY, ioctl(fd, TIOCSSERIAL, &ss) < 0))
+			printf("Low latency: %s: ASYNC_LOW_LATENCY not supported: %s\n", device, strerror(errno));
+		else
+			applied++;
+
+		if ((old = setLatencyTimer(device, optLowLatency)) < 0)
+			printf("Low latency: %s: no usb-serial latency timer\n", device);
+		else
+		{
+			applied++;
+			if (verbose > 0)
+				printf("Low latency: %s: latency timer %dms -> %dms\n", device, old, optLowLatency);
+		}
+	}
+
+	if (optRs485)
+	{
+		struct serial_rs485 rs485 = { .flags = SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND };
+
+		if (ioctl(fd, TIOCSRS485, &rs485) < 0)
+			printf("RS485: %s: direction control not supported: %s\n", device, strerror(errno));
+		else
+			applied++;
+	}
+
+	return(applied);
+}	// lowLatencySerial
+
+/**********************************************************************
+	Average time of a 2 register read in usec, -1 if meter m fails.
+**********************************************************************/
+long transactionUsec(meter_s_t *m)
+{
+	uint16_t dest[2];
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (int i = 0; i < latencyProbeReads; i++)
+		if (readMeterRegisters(m, latencyProbeReg, 2, dest) < 0)
+			return(-1);
+
+	return mbc_usec_since(&start) / latencyProbeReads;
+}	// transactionUsec
+
+/**********************************************************************
+	Apply -lowLatency / -rs485 to every bus and report the read time
+	before and after on its first meter.
+**********************************************************************/
+void lowLatencyAll(void)
+{
+	for (int b = 0; b < (ctx ? 1 : countBuses); b++)
+	{
+		const char *device = ctx ? serialDevice : buses[b]->device;
+		meter_s_t *m = meters;
+		long before, after;
+
+		while (m && (m->bus != (ctx ? NULL : buses[b])))
+			m = m->next;
+
+		before = (m && optLowLatency) ? transactionUsec(m) : -1;
+		if ((lowLatencySerial(ctx ? modbus_get_socket(ctx) : buses[b]->fd, device) == 0) || (before < 0))
+			continue;
+
+		after = transactionUsec(m);
+
+		if (after >= 0)
+			printf("Low latency: %s: 2 register read %.1fms -> %.1fms, %.1f -> %.1f reads/s\n",
+				device, before / 1000.0, after / 1000.0, 1e6 / before, 1e6 / after);
+	}
+}	// lowLatencyAll
+
+/**********************************************************************
+	Write queue
+	Register writes are collected per meter and sent by flushWrites()
+	with as few function 0x10 frames as possible: adjacent registers
+	are merged, a register written twice is sent once with the last
+	value. Every frame is verified by the echo of the response.
+**********************************************************************/
+void queueWrite(meter_s_t *m, uint16_t addr, int len, const uint16_t *values)
+{
+	for (int i = 0; i < len; i++, addr++)
+	{
+		int pos = 0;
+
+		while ((pos < m->countWrites) && (m->writeAddr[pos] < addr))
+			pos++;
+
+		if ((pos == m->countWrites) || (m->writeAddr[pos] != addr))
+		{	// insert at pos
+			if ((! (m->writeAddr = realloc(m->writeAddr, (m->countWrites + 1) * sizeof(*m->writeAddr))))
+				|| (! (m->writeValue = realloc(m->writeValue, (m->countWrites + 1) * sizeof(*m->writeValue)))))
+			{
+				printf("queueWrite realloc failed\n");
+				abort();
+			}
+
+			memmove(m->writeAddr + pos + 1, m->writeAddr + pos, (m->countWrites - pos) * sizeof(*m->writeAddr));
+			memmove(m->writeValue + pos + 1, m->writeValue + pos, (m->countWrites - pos) * sizeof(*m->writeValue));
+			m->countWrites++;
+		}
+
+		m->writeAddr[pos] = addr;
+		m->writeValue[pos] = values[i];
+	}
+}	// queueWrite
+
+/**********************************************************************
+	Number of queued registers from pos on that fit into one frame.
+**********************************************************************/
+int writeFrameLen(meter_s_t *m, int pos)
+{
+	int len = 1;
+
+	while ((pos + len < m->countWrites) && (len < MODBUS_MAX_WRITE_REGISTERS)
+		&& (m->writeAddr[pos + len] == m->writeAddr[pos] + len))
+		len++;
+
+	return len;
+}	// writeFrameLen
+
+/**********************************************************************
+	Write len registers at addr with one function 0x10 frame over ctx,
+	the response has to echo slave, function, address and quantity.
+	Slave 0 is a broadcast without response.
+**********************************************************************/
+int writeRegisters(uint8_t slave, uint16_t addr, int len, const uint16_t *values)
+{
+	uint8_t req[MODBUS_RTU_MAX_ADU_LENGTH];
+	uint8_t rsp[MODBUS_RTU_MAX_ADU_LENGTH];
+	int reqLen = mbc_request(req, slave, addr, len, values) - 2;	// libmodbus appends the CRC
+
+	modbus_set_slave(ctx, slave);
+
+	if (modbus_send_raw_request(ctx, req, reqLen) == -1)
+		return(-1);
+
+	if (slave == MODBUS_BROADCAST_ADDRESS)
+	{	// no response, give the slaves time to process the frame
+		usleep(frameUsec(reqLen + 2) + defaultTurnaroundUsec);
+		return(0);
+	}
+
+	int rspLen = modbus_receive_confirmation(ctx, rsp);
+
+	if (rspLen == -1)
+		return(-1);
+
+	if (verbose > 2)
+	{
+		printf("0x%04X Response [", addr);
+		for (int i = 0; i < rspLen; i++)
+			printf((i < rspLen - 1) ? "%02X " : "%02X", rsp[i]);
+		printf("]\n");
+	}
+
+	if ((rspLen < 6) || memcmp(rsp, req, 6))
+	{
+		errno = EMBBADDATA;
+		return(-1);
+	}
+
+	return(0);
+}	// writeRegisters
+
+/**********************************************************************
+	Send queued writes of all meters, concurrently on different buses
+	with -nb. Returns number of failed frames, the queues are emptied.
+**********************************************************************/
+int flushWrites(void)
+{
+	rtuTrans_s_t *trans = NULL;
+	int countTrans = 0;
+	int failed = 0;
+	meter_s_t *m;
+
+	for (m = meters; m; m = m->next)
+	{
+		for (int pos = 0; pos < m->countWrites; )
+		{
+			int len = writeFrameLen(m, pos);
+
+			if (verbose > 1)
+				printf("Write %s 0x%04X, %d registers\n", m->name, m->writeAddr[pos], len);
+
+			if (m->bus)
+			{	// sent below
+				if (! (trans = realloc(trans, (countTrans + 1) * sizeof(*trans))))
+				{
+					printf("flushWrites realloc failed\n");
+					abort();
+				}
+				memset(&trans[countTrans], 0, sizeof(*trans));
+				trans[countTrans].slave = m->slave;
+				trans[countTrans].addr = m->writeAddr[pos];
+				trans[countTrans].len = len;
+				trans[countTrans].src = m->writeValue + pos;
+				trans[countTrans].arg = m;
+				countTrans++;
+			}
+			else if (writeRegisters(m->slave, m->writeAddr[pos], len, m->writeValue + pos))
+			{
+				printf("Write %s 0x%04X, %d registers failed: %s\n", m->name, m->writeAddr[pos], len, modbus_strerror(errno));
+				failed++;
+			}
+
+			pos += len;
+		}
+	}
+
+	if (countTrans)
+	{	// the queue of a bus may only grow when all transactions are allocated
+		for (int i = 0; i < countTrans; i++)
+			rtuSubmit(((meter_s_t *) trans[i].arg)->bus, &trans[i]);
+
+		if (rtuRun())
+			failed += countTrans;
+		else
+		{
+			for (int i = 0; i < countTrans; i++)
+			{
+				if (! trans[i].rc)
+					continue;
+
+				printf("Write %s 0x%04X, %d registers failed: %s\n", ((meter_s_t *) trans[i].arg)->name,
+					trans[i].addr, trans[i].len, modbus_strerror(trans[i].err));
+				failed++;
+			}
+		}
+		free(trans);
+	}
+
+	for (m = meters; m; m = m->next)
+		m->countWrites = 0;
+
+	return failed;
+}	// flushWrites
+
+/**********************************************************************
+	Clock registers of date tm, now if NULL.
+	0xF000 BCD: sec, min, hour, week, day, month, year, 20
+**********************************************************************/
+void dateRegisters(struct tm *_tm, uint16_t *date)
+{
+	struct tm tm;
+
+	if (_tm)
+		tm = *_tm;
+	else
+	{	// use now as time
+		time_t raw_time;
+
+		time(&raw_time);
+		localtime_r(&raw_time, &tm);
+	}
+
+	if (verbose > 3)
+		printf("Set Time: %04d-%02d-%02d %02d:%02d:%02d\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+
+	mbc_encode_date(&tm, date);
+}	// dateRegisters
+
+/**********************************************************************
+	Queue write of date tm, now if NULL, to clock of meter.
+**********************************************************************/
+void setDate(meter_s_t *m, struct tm *tm)
+{
+	uint16_t date[4];
+
+	dateRegisters(tm, date);
+	queueWrite(m, 0xF000, 4, date);
+}	// setDate
+
+/**********************************************************************
+	Queue write of baudrate to meter, the meter switches after the
+	response. 0xF800: 1 1200, 2 2400, 3 4800, 4 9600
+**********************************************************************/
+int setBaudrate(meter_s_t *m, int _baudrate)
+{
+	uint16_t value = 0;
+
+	switch (_baudrate)
+	{
+	case 1200:
+		value = 1;
+		break;
+	case 2400:
+		value = 2;
+		break;
+	case 4800:
+		value = 3;
+		break;
+	case 9600:
+		value = 4;
+		break;
+	default:
+		printf("Error setBaudrate: %i Baud not supported.\n", _baudrate);
+		return -1;
+	}
+
+	queueWrite(m, 0xF800, 1, &value);
+
+	return 0;
+}	// setBaudrate
+
+/**********************************************************************
+	Output prefix: timestamp ts and meter if more than one.
+**********************************************************************/
+const char *meterPrefix(meter_s_t *m, struct timespec *ts)
+{
+	static char prefix[sizeof(dateNow) + 256];
+	int n = 0;
+
+	prefix[0] = '\0';
+
+	if (optTimestamp || optDaemon)
+	{
+		struct tm tm;
+
+		localtime_r(&ts->tv_sec, &tm);
+		strftime(dateNow, sizeof(dateNow), "%Y-%m-%d %H:%M:%S", &tm);
+		n = snprintf(prefix, sizeof(prefix), "%s.%03ld ", dateNow, ts->tv_nsec / 1000000);
+	}
+
+	if (countMeters > 1)
+		snprintf(prefix + n, sizeof(prefix) - n, "%s ", m->name);
+
+	return prefix;
+}	// meterPrefix
+
+/**********************************************************************
+	Output prefix of a sample: timestamp and meter if more than one.
+**********************************************************************/
+const char *samplePrefix(meter_s_t *m)
+{
+	return meterPrefix(m, &m->time.wallStart);
+}	// samplePrefix
+
+/**********************************************************************
+	Drift of meter clock (0xF000 in dest) against host clock [s].
+	The meter reports full seconds somewhere between request start and
+	response end, so host time is taken in the middle of the sample.
+**********************************************************************/
+int meterClockDrift(uint16_t *dest, sampleTime_s_t *t, double *drift, double *uncertainty)
+{
+	struct tm tm;
+
+	// BCD: ss mm hh w DD MM YY 20
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_sec	= MBC_BCD2INT(dest[0] >> 8);
+	tm.tm_min	= MBC_BCD2INT(dest[0] & 0xFF);
+	tm.tm_hour	= MBC_BCD2INT(dest[1] >> 8);
+	tm.tm_mday	= MBC_BCD2INT(dest[2] >> 8);
+	tm.tm_mon	= MBC_BCD2INT(dest[2] & 0xFF) - 1;
+	tm.tm_year	= MBC_BCD2INT(dest[3] & 0xFF) * 100 + MBC_BCD2INT(dest[3] >> 8) - 1900;
+	tm.tm_isdst	= -1;
+
+	time_t meterTime = mktime(&tm);
+	if (meterTime == (time_t) -1)
+		return(-1);
+
+	double start = t->wallStart.tv_sec + t->wallStart.tv_nsec / 1e9;
+	double end = t->wallEnd.tv_sec + t->wallEnd.tv_nsec / 1e9;
+
+	*drift = meterTime + 0.5 - (start + end) / 2;
+	*uncertainty = 0.5 + (end - start) / 2;
+
+	return(0);
+}	// meterClockDrift
+
+/**********************************************************************
+	Report drift of meter clock read into dest by the transaction
+	timed in t, resync with -setDate
+	if off more than -checkDate. Returns 1 if off, -1 on error.
+**********************************************************************/
+int checkMeterClock(meter_s_t *m, uint16_t *dest, sampleTime_s_t *t)
+{
+	double drift, uncertainty;
+
+	if (meterClockDrift(dest, t, &drift, &uncertainty))
+	{
+		printf("%sClock invalid: %04X %04X %04X %04X\n", samplePrefix(m), dest[0], dest[1], dest[2], dest[3]);
+		return(-1);
+	}
+
+	int off = (fabs(drift) - uncertainty > optCheckDate);
+
+	if (off || (! optDaemon) || (verbose > 0))
+		printf("%sClock drift %+.1fs +-%.1fs%s\n", samplePrefix(m), drift, uncertainty, off ? " exceeds limit" : "");
+
+	if (off && optSetDate)
+	{
+		setDate(m, NULL);
+
+		if (flushWrites())
+			printf("%sClock resync failed\n", samplePrefix(m));
+		else
+			printf("%sClock resync done\n", samplePrefix(m));
+	}
+
+	return(off);
+}	// checkMeterClock
+
+/**********************************************************************
+	-checkDate without -d: read clock of every meter.
+	Returns number of meters off more than limit or failed.
+**********************************************************************/
+int checkDateAll(void)
+{
+	int count = 0;
+
+	for (meter_s_t *m = meters; m; m = m->next)
+	{
+		uint16_t dest[4];
+
+		stampTime(&m->time.monoStart, &m->time.wallStart);
+
+		if (readMeterRegisters(m, 0xF000, 4, dest) == -1)
+		{
+			printf("%sRead clock failed: %s\n", samplePrefix(m), modbus_strerror(errno));
+			count++;
+			continue;
+		}
+
+		stampTime(&m->time.monoEnd, &m->time.wallEnd);
+
+		if (checkMeterClock(m, dest, &m->time))
+			count++;
+	}
+
+	return count;
+}	// checkDateAll
+
+/**********************************************************************
+	-setDate -broadcast n: set the clocks of all meters of a bus with
+	one broadcast frame. The meters take the time when the frame is
+	received, so it is sent the frame time ahead of the second it
+	carries. Afterwards the clocks of n meters spread over the list
+	are checked like -checkDate does, off ones are set one by one.
+**********************************************************************/
+int broadcastDate(int sample)
+{
+	long usec = frameUsec(7 + 8 + 2);	// header, 4 registers, CRC
+	struct timespec now, at;
+	uint16_t date[4];
+	struct tm tm;
+	int failed = 0;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	// next second that leaves 100ms to prepare the frame
+	time_t second = now.tv_sec + 1 + (now.tv_nsec / 1000 + usec + 100000) / 1000000;
+
+	at.tv_sec = second - 1 - usec / 1000000;
+	at.tv_nsec = (1000000 - usec % 1000000) * 1000;
+	if (at.tv_nsec >= 1000000000L)
+	{
+		at.tv_sec++;
+		at.tv_nsec -= 1000000000L;
+	}
+
+	localtime_r(&second, &tm);
+	dateRegisters(&tm, date);
+
+	if (verbose > 0)
+		printf("Broadcast date %ld, frame %ldms\n", (long) second, usec / 1000);
+
+	while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &at, NULL) == EINTR)
+		;
+
+	if (countBuses)
+	{	// all buses at the same time
+		rtuTrans_s_t *trans = calloc(countBuses, sizeof(*trans));
+
+		if (! trans)
+		{
+			printf("broadcastDate malloc failed\n");
+			abort();
+		}
+
+		for (int b = 0; b < countBuses; b++)
+		{
+			trans[b].slave = MODBUS_BROADCAST_ADDRESS;
+			trans[b].addr = 0xF000;
+			trans[b].len = 4;
+			trans[b].src = date;
+			rtuSubmit(buses[b], &trans[b]);
+		}
+
+		if (rtuRun())
+			failed = countBuses;
+		for (int b = 0; b < countBuses; b++)
+			if (trans[b].rc)
+			{
+				printf("Broadcast date on %s failed: %s\n", buses[b]->device, modbus_strerror(trans[b].err));
+				failed++;
+			}
+		free(trans);
+	}
+	else if (writeRegisters(MODBUS_BROADCAST_ADDRESS, 0xF000, 4, date))
+	{
+		printf("Broadcast date failed: %s\n", modbus_strerror(errno));
+		failed++;
+	}
+
+	if (failed)
+		return(-1);
+
+	// verify sample
+	int i = 0;
+	int step = (sample > 0) && (sample < countMeters) ? countMeters / sample : 1;
+
+	for (meter_s_t *m = meters; m && sample; m = m->next, i++)
+	{
+		uint16_t dest[4];
+
+		if (i % step)
+			continue;
+		sample--;
+
+		stampTime(&m->time.monoStart, &m->time.wallStart);
+
+		if (readMeterRegisters(m, 0xF000, 4, dest) == -1)
+		{
+			printf("%sRead clock failed: %s\n", samplePrefix(m), modbus_strerror(errno));
+			failed++;
+			continue;
+		}
+
+		stampTime(&m->time.monoEnd, &m->time.wallEnd);
+
+		if (checkMeterClock(m, dest, &m->time))
+			failed++;
+	}
+
+	return(failed);
+}	// broadcastDate
+
+/**********************************************************************
+	-tariff: compare tariff table of every meter with schedule, with
+	-setTariff write the registers that differ. Meters that match cost
+	one read. Returns number of meters that differ or failed.
+**********************************************************************/
+int tariffAll(const char *schedule, char write)
+{
+	uint16_t want[MBC_TARIFF_LEN];
+	int count = 0;
+	meter_s_t *m;
+
+	if (mbc_parse_tariff(schedule, want))
+	{	// times ascending, tariff 1-4, at most 10 segments
+		printf("Invalid tariff schedule '%s'.\n", schedule);
+		return(-1);
+	}
+
+	for (m = meters; m; m = m->next)
+	{
+		uint16_t have[MBC_TARIFF_LEN];
+		char haveStr[MBC_TARIFF_SEGMENTS * 12], wantStr[MBC_TARIFF_SEGMENTS * 12];
+		int diff = 0;
+
+		stampTime(&m->time.monoStart, &m->time.wallStart);
+
+		if (readMeterRegisters(m, MBC_TARIFF_REG, MBC_TARIFF_LEN, have) == -1)
+		{
+			printf("%sRead tariff failed: %s\n", samplePrefix(m), modbus_strerror(errno));
+			count++;
+			continue;
+		}
+
+		for (int i = 0; i < MBC_TARIFF_LEN; i++)
+		{
+			if (have[i] == want[i])
+				continue;
+
+			if (write)
+				queueWrite(m, MBC_TARIFF_REG + i, 1, want + i);
+			diff++;
+		}
+
+		mbc_format_tariff(have, haveStr, sizeof(haveStr));
+
+		if (! diff)
+		{
+			if (verbose > 0)
+				printf("%sTariff %s matches\n", samplePrefix(m), haveStr);
+			continue;
+		}
+
+		mbc_format_tariff(want, wantStr, sizeof(wantStr));
+		printf("%sTariff %s differs in %d registers, %s %s\n", samplePrefix(m), haveStr, diff, write ? "writing" : "wanted", wantStr);
+		count++;
+	}
+
+	if (write && flushWrites())
+		return(-1);
+
+	return(count);
+}	// tariffAll
+
+/**********************************************************************
+	Register map discovery
+	Read one block, returns 1 if readable, 0 if rejected by the meter
+	(exception response, no response or a bad one twice), -1 on errors
+	of the device.
+**********************************************************************/
+int scanReads = 0;
+int scanTimeouts = 0;
+int scanBadResponses = 0;
+
+int scanRead(meter_s_t *m, unsigned int addr, int len, uint16_t *dest)
+{
+	for (int retry = 0; retry < 2; retry++)
+	{
+		scanReads++;
+
+		if (readMeterRegisters(m, addr, len, dest) == len)
+			return 1;
+
+		if ((errno > MODBUS_ENOBASE) && (errno <= EMBXGTAR))
+			return 0;
+	}
+
+	if (errno == ETIMEDOUT)
+	{	// some meters do not answer invalid requests
+		scanTimeouts++;
+		return 0;
+	}
+
+	if (errno > MODBUS_ENOBASE)
+	{	// bad CRC, data or length, e.g. 0xF600 answers garbage
+		if (verbose > 0)
+			fprintf(stderr, "Scan 0x%04X, %d: %s\n", addr, len, modbus_strerror(errno));
+		scanBadResponses++;
+		return 0;
+	}
+
+	return -1;
+}	// scanRead
+
+/**********************************************************************
+	Mark readable registers of addr..addr+len-1. If the meter rejects
+	the block, walk it: a readable register is extended by doubling the
+	read length and the end of the range is found by bisection, so an
+	unreadable register costs one read and a readable range log2(len).
+**********************************************************************/
+int scanBlock(meter_s_t *m, unsigned int addr, int len, uint8_t *valid, uint16_t *dest)
+{
+	unsigned int end = addr + len;
+	int rc = scanRead(m, addr, len, dest);
+
+	if (rc == 1)
+		memset(valid + addr, 1, len);
+
+	if (rc != 0)
+		return rc;
+
+	while (addr < end)
+	{
+		int lo = 1, hi;
+
+		if ((rc = scanRead(m, addr, 1, dest)) != 1)
+		{
+			if (rc == -1)
+				return -1;
+			addr++;
+			continue;
+		}
+
+		// lo is readable, hi is not or beyond block
+		while (((hi = 2 * lo) <= end - addr) && ((rc = scanRead(m, addr, hi, dest)) == 1))
+			lo = hi;
+		if (hi > end - addr)
+			hi = end - addr + 1;
+
+		while ((rc != -1) && (hi - lo > 1))
+		{
+			int mid = (lo + hi) / 2;
+
+			if ((rc = scanRead(m, addr, mid, dest)) == 1)
+				lo = mid;
+			else
+				hi = mid;
+		}
+
+		if (rc == -1)
+			return -1;
+
+		memset(valid + addr, 1, lo);
+		addr += lo;
+	}
+
+	return 0;
+}	// scanBlock
+
+/**********************************************************************
+	Longest read accepted at start of a readable run of len registers.
+**********************************************************************/
+int scanMaxRead(meter_s_t *m, unsigned int addr, int len, uint16_t *dest)
+{
+	int lo = 1;
+	int hi = (len < MODBUS_MAX_READ_REGISTERS) ? len : MODBUS_MAX_READ_REGISTERS;
+
+	while (lo < hi)
+	{	// lo is readable, more than hi is not
+		int mid = (lo + hi + 1) / 2;
+		int rc = scanRead(m, addr, mid, dest);
+
+		if (rc == -1)
+			return -1;
+
+		if (rc)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return lo;
+}	// scanMaxRead
+
+/**********************************************************************
+	-scan: find readable registers first..last of meter m with block
+	reads of -mb registers, walking blocks the meter rejects. Prints a
+	register map for -regDef: catalog entries that are readable as a
+	whole and raw entries for readable registers not in the catalog.
+**********************************************************************/
+int scanRegisters(meter_s_t *m, unsigned int first, unsigned int last)
+{
+	uint8_t *valid = calloc(0x10000 + 1, sizeof(*valid));
+	uint16_t dest[MODBUS_MAX_READ_REGISTERS];
+	int chunk = 1;
+	int runs = 0;
+	time_t now = time(NULL);
+
+	if (! valid)
+	{
+		printf("scanRegisters malloc failed\n");
+		abort();
+	}
+
+	while (chunk * 2 <= maxBlockLen)
+		chunk *= 2;
+
+	for (unsigned int addr = first; addr <= last; )
+	{	// aligned blocks
+		unsigned int end = (addr / chunk + 1) * chunk - 1;
+
+		if (end > last)
+			end = last;
+
+		if (verbose > 0)
+			fprintf(stderr, "Scan 0x%04X-0x%04X, %d reads\n", addr, end, scanReads);
+
+		if (scanBlock(m, addr, end - addr + 1, valid, dest) == -1)
+		{
+			printf("Scan 0x%04X failed: %s\n", addr, modbus_strerror(errno));
+			free(valid);
+			return(-1);
+		}
+		addr = end + 1;
+	}
+
+	strftime(dateNow, sizeof(dateNow), "%Y-%m-%d %H:%M:%S", localtime(&now));
+	printf("# mbc -scan 0x%04X,0x%04X slave %d, %s\n", first, last, m->slave, dateNow);
+
+	for (unsigned int addr = first; addr <= last; )
+	{
+		unsigned int start = addr, runEnd;
+		int maxRead;
+
+		if (! valid[addr])
+		{
+			addr++;
+			continue;
+		}
+
+		for (runEnd = addr; (runEnd < last) && valid[runEnd + 1]; runEnd++)
+			;
+
+		if ((maxRead = scanMaxRead(m, start, runEnd - start + 1, dest)) == -1)
+		{
+			printf("Scan 0x%04X failed: %s\n", start, modbus_strerror(errno));
+			free(valid);
+			return(-1);
+		}
+
+		printf("# 0x%04X-0x%04X %d registers, max read %d\n", start, runEnd, runEnd - start + 1, maxRead);
+		runs++;
+
+		while (addr <= runEnd)
+		{
+			regDef_s_t *rd = lookupRegDef(addr);
+			unsigned int raw = addr;
+
+			if (rd && rd->regLen && (addr + rd->regLen - 1 <= runEnd) && (rd->regLen <= maxRead))
+			{	// known register
+				printf("0x%04X %4d %4d %4d\t%s\t%s\n", rd->regNr, rd->regLen, rd->regType, rd->regBase10, rd->unitStr, rd->descStr);
+				addr += rd->regLen;
+				continue;
+			}
+
+			// raw registers up to the next known one
+			do
+				addr++;
+			while ((addr <= runEnd) && (addr - raw < maxRead) && (! lookupRegDef(addr)));
+
+			printf("0x%04X %4d %4d %4d\t\tScanned 0x%04X\n", raw, addr - raw, 8, 0, raw);
+		}
+	}
+
+	printf("# %d ranges, %d reads, %d without response, %d bad responses\n", runs, scanReads, scanTimeouts, scanBadResponses);
+
+	free(valid);
+
+	return(0);
+}	// scanRegisters
+
+/**********************************************************************
+	Derived metrics, computed from the raw values of every sample with
+	constant state per meter.
+**********************************************************************/
+const unsigned int derivedRegs[] = {
+	0x0050, 0x0052, 0x0054,					// Current L1-L3
+	0x0096, 0x00D6, 0x0116, 0x0156			// Power, Apparent, Reactive Power, Power Factor Total
+};
+
+// changes against the previous sample, only with -d
+const unsigned int derivedHistoryRegs[] = {
+	0x0160,									// Import Energy
+	0x07D0, 0x07D2, 0x07D4, 0x07D6			// Import Energy Rate 1-4
+};
+
+/**********************************************************************
+	Add registers needed by -checkDate (daemon) and -derived to plan.
+**********************************************************************/
+readPlan_s_t *preparePlan(readPlan_s_t *plan)
+{
+	const unsigned int clockReg = 0xF000;
+	const unsigned int powerReg = 0x0096;	// Power Total
+
+	if (optCheckDate && optDaemon)
+		plan = addHiddenRegisters(plan, &clockReg, 1);
+
+	if (plan && optDerived)
+		plan = addHiddenRegisters(plan, derivedRegs, sizeof(derivedRegs) / sizeof(derivedRegs[0]));
+
+	if (plan && optDerived && optDaemon)
+		plan = addHiddenRegisters(plan, derivedHistoryRegs, sizeof(derivedHistoryRegs) / sizeof(derivedHistoryRegs[0]));
+
+	if (plan && optDemand && optDaemon)
+		plan = addHiddenRegisters(plan, &powerReg, 1);
+
+	return plan;
+}	// preparePlan
+
+/**********************************************************************
+**********************************************************************/
+void setupDerivedPlan(readPlan_s_t *plan, derivedPlan_s_t *dp)
+{
+	dp->importEnergy = findPlanItem(plan, 0x0160);
+	for (int i = 0; i < 3; i++)
+		dp->current[i] = findPlanItem(plan, 0x0050 + 2 * i);
+	for (int i = 0; i < 4; i++)
+		dp->rate[i] = findPlanItem(plan, 0x07D0 + 2 * i);
+	dp->powerTotal = findPlanItem(plan, 0x0096);
+	dp->apparentTotal = findPlanItem(plan, 0x00D6);
+	dp->reactiveTotal = findPlanItem(plan, 0x0116);
+	dp->pfTotal = findPlanItem(plan, 0x0156);
+}	// setupDerivedPlan
+
+/**********************************************************************
+**********************************************************************/
+double planValue(readPlan_s_t *plan, uint16_t *buf, int item)
+{
+	if (item < 0)
+		return NAN;
+
+	regDef_s_t *rd = plan->item[item].rd;
+
+	return mbc_value(rd->regType, rd->regBase10, buf + plan->item[item].offset);
+}	// planValue
+
+/**********************************************************************
+	Compute derived metrics of one sample of meter m into value,
+	countDerived in the order of derivedMetrics[], NAN if unknown.
+**********************************************************************/
+void computeDerived(meter_s_t *m, readPlan_s_t *plan, derivedPlan_s_t *dp, uint16_t *buf, double *value)
+{
+	derivedState_s_t *st = &m->derived;
+	double now = m->time.monoStart.tv_sec + m->time.monoStart.tv_nsec / 1e9;
+	double energy = planValue(plan, buf, dp->importEnergy);
+	int i;
+
+	// average power over the last change of the energy counter, its
+	// resolution is too coarse for the delta of a single poll period
+	if (! st->valid)
+	{
+		st->energyRef = energy;
+		st->timeRef = now;
+		st->avgPower = NAN;
+	}
+	else if ((energy != st->energyRef) && (now > st->timeRef))
+	{
+		st->avgPower = (energy - st->energyRef) * 3600 / (now - st->timeRef);
+		st->energyRef = energy;
+		st->timeRef = now;
+	}
+	value[0] = st->avgPower;
+
+	// deviation of most unbalanced phase from average current
+	double current[3], mean = 0, dev = 0;
+
+	for (i = 0; i < 3; i++)
+	{	// NAN for single phase models
+		int item = (m->present && (dp->current[i] >= 0) && (! m->present[dp->current[i]])) ? -1 : dp->current[i];
+
+		mean += (current[i] = planValue(plan, buf, item)) / 3;
+	}
+	for (i = 0; i < 3; i++)
+		if (fabs(current[i] - mean) > dev)
+			dev = fabs(current[i] - mean);
+	value[1] = (mean > 0) ? dev / mean * 100 : NAN;
+
+	// consumption per tariff rate since previous sample
+	for (i = 0; i < 4; i++)
+	{
+		double rate = planValue(plan, buf, dp->rate[i]);
+
+		value[2 + i] = st->valid ? rate - st->rate[i] : NAN;
+		st->rate[i] = rate;
+	}
+
+	// active, reactive and apparent power have to match
+	double p = planValue(plan, buf, dp->powerTotal);
+	double s = planValue(plan, buf, dp->apparentTotal);
+	double q = planValue(plan, buf, dp->reactiveTotal);
+	double pf = planValue(plan, buf, dp->pfTotal);
+
+	value[6] = (s > 0) ? p / s : NAN;
+	value[7] = (s > 0) ? p / s - pf : NAN;
+	value[8] = (s > 0) ? (sqrt(p * p + q * q) - s) / s * 100 : NAN;
+
+	st->valid = 1;
+}	// computeDerived
+
+
+/**********************************************************************
+	Report by exception
+	A value is emitted if it moved more than its deadband since it was
+	last emitted, or if it was silent for -heartbeat seconds. Values
+	without a numeric meaning (date, tariff table) on any change.
+**********************************************************************/
+deadband_s_t *deadbandFor(uint16_t regNr)
+{
+	deadband_s_t *all = NULL;
+
+	for (int i = 0; i < countDeadbands; i++)
+	{
+		if (deadbands[i].regNr == regNr)
+			return &deadbands[i];
+		if (deadbands[i].regNr < 0)
+			all = &deadbands[i];
+	}
+
+	return all;
+}	// deadbandFor
+
+/**********************************************************************
+	Mark items of sample in m->emitted, returns number to emit.
+**********************************************************************/
+int changedItems(meter_s_t *m, readPlan_s_t *plan, uint16_t *buf)
+{
+	time_t now = m->time.wallStart.tv_sec;
+	char first = ! m->emitBuf;
+	int count = 0;
+
+	if (first)
+	{
+		m->emitBuf = calloc(plan->bufLen, sizeof(*m->emitBuf));
+		m->emitTime = calloc(plan->countVisible, sizeof(*m->emitTime));
+		m->emitted = calloc(plan->countVisible, sizeof(*m->emitted));
+
+		if (! m->emitBuf || ! m->emitTime || ! m->emitted)
+		{
+			printf("changedItems malloc failed\n");
+			abort();
+		}
+	}
+
+	for (int i = 0; i < plan->countVisible; i++)
+	{
+		regDef_s_t *rd = plan->item[i].rd;
+		uint16_t *cur = buf + plan->item[i].offset;
+		uint16_t *last = m->emitBuf + plan->item[i].offset;
+		double v = mbc_value(rd->regType, rd->regBase10, cur);
+		char emit = first || (now - m->emitTime[i] >= optHeartbeat);
+
+		if (m->present && (! m->present[i]))
+			emit = 0;
+		else if (emit)
+			;
+		else if (isnan(v))
+			emit = memcmp(cur, last, rd->regLen * sizeof(*cur)) != 0;
+		else
+		{
+			deadband_s_t *db = deadbandFor(rd->regNr);
+			double lastValue = mbc_value(rd->regType, rd->regBase10, last);
+			double band = ! db ? 0 : db->relative ? db->band / 100 * fabs(lastValue) : db->band;
+
+			emit = fabs(v - lastValue) > band;
+		}
+
+		if ((m->emitted[i] = emit))
+		{
+			memcpy(last, cur, rd->regLen * sizeof(*cur));
+			m->emitTime[i] = now;
+			count++;
+		}
+	}
+
+	return count;
+}	// changedItems
+
+/**********************************************************************
+	Line protocol sink
+	Samples are formatted as line protocol into a batch, sent when it
+	is large or old enough. Nothing blocks: the socket is non-blocking,
+	what it does not take goes to the spool file, which is replayed
+	before new lines as soon as the receiver is back. Spool and batch
+	hold whole lines only, a line cut by a lost connection is sent
+	again from its start on the next one.
+**********************************************************************/
+void sinkClose(void)
+{
+	if (sink.fd >= 0)
+		close(sink.fd);
+	sink.fd = -1;
+	sink.connecting = 0;
+	sink.sent = 0;
+	sink.spoolPos = sink.spoolLine;
+}	// sinkClose
+
+/**********************************************************************
+	Bytes of data[0..len) up to and including its last newline.
+**********************************************************************/
+size_t sinkLines(const char *data, size_t len)
+{
+	while (len && (data[len - 1] != '\n'))
+		len--;
+
+	return len;
+}	// sinkLines
+
+/**********************************************************************
+	Address of target into addr, 0 if valid. Host names are resolved
+	here, at start and reload, a DNS lookup must not block polling
+	at every reconnect.
+**********************************************************************/
+int sinkResolve(const char *target, struct sockaddr_storage *addr, socklen_t *addrLen)
+{
+	memset(addr, 0, sizeof(*addr));
+
+	if (strncmp(target, "unix:", 5) == 0)
+	{
+		struct sockaddr_un *sa = (struct sockaddr_un *) addr;
+
+		sa->sun_family = AF_UNIX;
+		strncpy(sa->sun_path, target + 5, sizeof(sa->sun_path) - 1);
+		*addrLen = sizeof(*sa);
+		return(0);
+	}
+	else if (strncmp(target, "tcp:", 4) == 0)
+	{
+		char host[256];
+		char *port;
+		struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+		struct addrinfo *ai;
+		int rc;
+
+		snprintf(host, sizeof(host), "%s", target + 4);
+		if ((port = strrchr(host, ':')))
+		{
+			*port++ = '\0';
+
+			if ((rc = getaddrinfo(host, port, &hints, &ai)) == 0)
+			{
+				memcpy(addr, ai->ai_addr, ai->ai_addrlen);
+				*addrLen = ai->ai_addrlen;
+				freeaddrinfo(ai);
+				return(0);
+			}
+
+			printf("Sink %s: %s\n", target, gai_strerror(rc));
+			return(-1);
+		}
+	}
+
+	printf("Sink %s: not unix:<path> or tcp:<host>:<port>\n", target);
+	return(-1);
+}	// sinkResolve
+
+/**********************************************************************
+	Use target and spool file, keeps collected lines on change.
+**********************************************************************/
+int sinkSetup(const char *target, const char *spoolFile)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrLen;
+
+	if (sinkResolve(target, &addr, &addrLen))
+		return(-1);
+
+	if ((! sink.target) || strcmp(sink.target, target) || (addrLen != sink.addrLen) || memcmp(&addr, &sink.addr, addrLen))
+	{
+		sinkClose();
+		free(sink.target);
+		sink.target = strdup(target);
+		sink.addr = addr;
+		sink.addrLen = addrLen;
+	}
+
+	if (spoolFile && ((! sink.spoolFile) || strcmp(sink.spoolFile, spoolFile)))
+	{
+		int fd = open(spoolFile, O_RDWR | O_CREAT | O_APPEND, 0644);
+
+		if (fd < 0)
+		{
+			printf("Open spool file '%s' failed: %s\n", spoolFile, strerror(errno));
+			return(-1);
+		}
+
+		if (sink.spoolFd >= 0)
+			close(sink.spoolFd);
+		free(sink.spoolFile);
+
+		sink.spoolFile = strdup(spoolFile);
+		sink.spoolFd = fd;
+		sink.spoolPos = sink.spoolLine = 0;		// replay what an earlier run left
+		sink.spoolLen = lseek(fd, 0, SEEK_END);
+
+		char last = '\n';
+		if ((sink.spoolLen > 0) && (pread(fd, &last, 1, sink.spoolLen - 1) == 1) && (last != '\n')
+			&& (write(fd, "\n", 1) == 1))
+			sink.spoolLen++;	// end a line cut by an earlier run
+	}
+
+	return(0);
+}	// sinkSetup
+
+/**********************************************************************
+	Start non-blocking connect, 0 if connected or in progress.
+**********************************************************************/
+int sinkConnect(void)
+{
+	if ((sink.fd = socket(sink.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0)
+		return(-1);
+
+	if (connect(sink.fd, (struct sockaddr *) &sink.addr, sink.addrLen) == 0)
+		return(0);
+
+	if ((errno == EINPROGRESS) && (sink.addr.ss_family != AF_UNIX))
+	{
+		sink.connecting = 1;
+		return(0);
+	}
+
+	sinkClose();
+	return(-1);
+}	// sinkConnect
+
+/**********************************************************************
+	Connected and writable, completes a pending tcp connect.
+**********************************************************************/
+int sinkReady(void)
+{
+	if ((sink.fd < 0) && sinkConnect())
+		return(0);
+
+	if (sink.connecting)
+	{
+		struct pollfd pfd = { .fd = sink.fd, .events = POLLOUT };
+		int err = 0;
+		socklen_t errLen = sizeof(err);
+
+		if (poll(&pfd, 1, 0) <= 0)
+			return(0);
+
+		if (getsockopt(sink.fd, SOL_SOCKET, SO_ERROR, &err, &errLen) || err)
+		{
+			sinkClose();
+			return(0);
+		}
+		sink.connecting = 0;
+	}
+
+	return(1);
+}	// sinkReady
+
+/**********************************************************************
+	Send up to len bytes, returns bytes taken or -1 if connection lost.
+**********************************************************************/
+ssize_t sinkSend(const char *data, size_t len)
+{
+	ssize_t n = send(sink.fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+	if (n >= 0)
+		return n;
+
+	if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+		return 0;
+
+	if (verbose > 0)
+		printf("Sink %s lost: %s\n", sink.target, strerror(errno));
+
+	sinkClose();
+	return -1;
+}	// sinkSend
+
+/**********************************************************************
+	Send or spool the batch. With force the batch goes out regardless
+	of its size and age.
+**********************************************************************/
+void sinkFlush(char force)
+{
+	char ready;
+
+	if ((! sink.target) || ((! force) && (sink.len < sinkBatchBytes) && (mbc_usec_since(&sink.batchStart) < optFlushUsec)))
+		return;
+
+	ready = sinkReady();
+
+	// replay spool first, it holds older lines
+	while (ready && (sink.spoolPos < sink.spoolLen))
+	{
+		char chunk[sinkChunkBytes];
+		ssize_t n = pread(sink.spoolFd, chunk, sizeof(chunk), sink.spoolPos);
+
+		if ((n <= 0) || ((n = sinkSend(chunk, n)) <= 0))
+			break;
+
+		if (sinkLines(chunk, n))
+			sink.spoolLine = sink.spoolPos + sinkLines(chunk, n);
+		sink.spoolPos += n;
+
+		if (sink.spoolPos == sink.spoolLen)
+		{	// drained, start over
+			if (ftruncate(sink.spoolFd, 0) == 0)
+				sink.spoolPos = sink.spoolLine = sink.spoolLen = 0;
+			if (verbose > 0)
+				printf("Sink %s: spool replayed\n", sink.target);
+		}
+	}
+
+	if (! sink.len)
+		return;
+
+	if (ready && (sink.spoolPos == sink.spoolLen))
+	{
+		ssize_t n = sinkSend(sink.buf + sink.sent, sink.len - sink.sent);
+
+		if (n > 0)
+		{	// remove whole lines, remember the sent head of a cut one
+			size_t done = sinkLines(sink.buf, sink.sent + n);
+
+			memmove(sink.buf, sink.buf + done, sink.len - done);
+			sink.len -= done;
+			sink.sent = sink.sent + n - done;
+		}
+	}
+
+	if (! sink.len)
+		return;
+
+	if ((sink.spoolFd >= 0) && (! sink.sent))
+	{	// keep order: rest of batch behind the spool
+		ssize_t n = write(sink.spoolFd, sink.buf, sink.len);
+
+		if (n == (ssize_t) sink.len)
+		{
+			sink.spoolLen += n;
+			sink.len = 0;
+		}
+		else if ((n > 0) && ftruncate(sink.spoolFd, sink.spoolLen))
+			printf("Sink spool '%s' truncate failed: %s\n", sink.spoolFile, strerror(errno));
+	}
+
+	if (sink.len >= 16 * sinkBatchBytes)
+	{	// receiver down and nowhere to spool, keep a line being sent
+		size_t keep = sink.sent ? (char *) memchr(sink.buf, '\n', sink.len) - sink.buf + 1 : 0;
+
+		for (size_t i = keep; i < sink.len; i++)
+			if (sink.buf[i] == '\n')
+				sink.dropped++;
+		sink.len = keep;
+
+		printf("Sink %s: %ld lines dropped\n", sink.target, sink.dropped);
+	}
+}	// sinkFlush
+
+/**********************************************************************
+	Append printf formatted text to batch.
+**********************************************************************/
+void sinkPrintf(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
+
+void sinkPrintf(const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (! sink.len)
+		clock_gettime(CLOCK_MONOTONIC, &sink.batchStart);
+
+	for (;;)
+	{
+		va_start(ap, fmt);
+		n = vsnprintf(sink.buf + sink.len, sink.size - sink.len, fmt, ap);
+		va_end(ap);
+
+		if ((n >= 0) && (sink.len + n < sink.size))
+			break;
+
+		sink.size = (sink.size + n + 1) * 2;
+		if (! (sink.buf = realloc(sink.buf, sink.size)))
+		{
+			printf("sinkPrintf realloc failed\n");
+			abort();
+		}
+	}
+
+	sink.len += n;
+}	// sinkPrintf
+
+/**********************************************************************
+	Append str escaped for line protocol keys and tag values.
+**********************************************************************/
+void sinkEscaped(const char *str)
+{
+	for (const char *cp = str; *cp; cp++)
+	{
+		if ((*cp == ' ') || (*cp == ',') || (*cp == '='))
+			sinkPrintf("\\%c", *cp);
+		else
+			sinkPrintf("%c", *cp);
+	}
+}	// sinkEscaped
+
+/**********************************************************************
+	Measurement and tags of a line.
+**********************************************************************/
+void sinkTags(const char *measurement, meter_s_t *m, const char *report)
+{
+	sinkPrintf("%s,meter=", measurement);
+	sinkEscaped(m->name);
+	sinkPrintf(",report=");
+	sinkEscaped(report);
+}	// sinkTags
+
+/**********************************************************************
+	One line per sample, numeric visible items and known derived
+	values as fields. buf NULL: derived values only, with -rollup.
+**********************************************************************/
+void sinkSample(meter_s_t *m, readPlan_s_t *plan, uint16_t *buf, const char *mask, const double *derived)
+{
+	char sep = ' ';
+
+	sinkTags("mbc", m, plan->name);
+
+	for (int i = 0; buf && (i < plan->countVisible); i++)
+	{
+		regDef_s_t *rd = plan->item[i].rd;
+		double v = mbc_value(rd->regType, rd->regBase10, buf + plan->item[i].offset);
+
+		if (isnan(v) || (mask && (! mask[i])) || (m->present && (! m->present[i])))
+			continue;
+
+		sinkPrintf("%c", sep);
+		sinkEscaped(rd->descStr);
+		sinkPrintf("=%.*f", (rd->regType == 1) ? 0 : -rd->regBase10, v);
+		sep = ',';
+	}
+
+	for (int i = 0; derived && (i < countDerived); i++)
+	{
+		if (isnan(derived[i]))
+			continue;
+
+		sinkPrintf("%c", sep);
+		sinkEscaped(derivedMetrics[i].title);
+		sinkPrintf("=%.*f", derivedMetrics[i].decimals, derived[i]);
+		sep = ',';
+	}
+
+	if (sep == ' ')		// line protocol needs a field
+		sinkPrintf(" valid=true");
+
+	sinkPrintf(" %ld%09ld\n", (long) m->time.wallStart.tv_sec, m->time.wallStart.tv_nsec);
+	sinkFlush(0);
+}	// sinkSample
+
+/**********************************************************************
+	One line per closed rollup window, fields suffixed _min _max _avg
+	_last, timestamp is the window start.
+**********************************************************************/
+void sinkRollup(meter_s_t *m, const char *length, rollup_s_t *r, time_t start)
+{
+	readPlan_s_t *plan = m->plan;
+	char sep = ' ';
+	int n = 0;
+
+	sinkTags("mbc_rollup", m, plan->name);
+	sinkPrintf(",window=%s", length);
+
+	for (int i = 0; i < plan->countVisible; i++)
+	{
+		regDef_s_t *rd = plan->item[i].rd;
+		int decimals = (rd->regType == 1) ? 0 : -rd->regBase10;
+		int avgDecimals = (decimals < 1) ? 1 : decimals;	// mean of integers is fractional
+		static const char *suffix[] = { "min", "max", "avg", "last" };
+		double v[] = { r[i].min, r[i].max, r[i].sum / r[i].count, r[i].last };
+
+		if (r[i].count == 0)
+			continue;
+
+		for (int f = 0; f < 4; f++)
+		{
+			sinkPrintf("%c", sep);
+			sinkEscaped(rd->descStr);
+			sinkPrintf("_%s=%.*f", suffix[f], (f == 2) ? avgDecimals : decimals, v[f]);
+			sep = ',';
+		}
+
+		if (r[i].count > n)
+			n = r[i].count;
+	}
+
+	sinkPrintf("%cn=%di %ld000000000\n", sep, n, (long) start);
+	sinkFlush(0);
+}	// sinkRollup
+
+/**********************************************************************
+	Rollups: min/max/avg/last of every visible plan item over windows
+	aligned to wall clock boundaries in local time. A window is output
+	when the first sample of the next window arrives, open windows are
+	dropped on exit.
+**********************************************************************/
+time_t windowStart(time_t t, int window)
+{
+	struct tm tm;
+
+	localtime_r(&t, &tm);
+
+	return (t + tm.tm_gmtoff) / window * window - tm.tm_gmtoff;
+}	// windowStart
+
+/**********************************************************************
+**********************************************************************/
+void outputRollup(meter_s_t *m, int w, rollup_s_t *r)
+{
+	readPlan_s_t *plan = m->plan;
+	struct timespec ts = { .tv_sec = m->rollupStart[w], .tv_nsec = 0 };
+	const char *prefix = meterPrefix(m, &ts);
+	int window = rollupWindows[w];
+	char length[16];
+
+	if (window % 3600 == 0)
+		snprintf(length, sizeof(length), "%dh", window / 3600);
+	else if (window % 60 == 0)
+		snprintf(length, sizeof(length), "%dm", window / 60);
+	else
+		snprintf(length, sizeof(length), "%ds", window);
+
+	if (sink.target)
+	{
+		sinkRollup(m, length, r, m->rollupStart[w]);
+		return;
+	}
+
+	for (int i = 0; i < plan->countVisible; i++)
+	{
+		regDef_s_t *rd = plan->item[i].rd;
+		int decimals = (rd->regType == 1) ? 0 : -rd->regBase10;
+		int avgDecimals = (decimals < 1) ? 1 : decimals;	// mean of integers is fractional
+		const char *unit = optUnit ? rd->unitStr : "";
+
+		if (r[i].count == 0)
+			continue;
+
+		printf("%s%s ", prefix, length);
+
+		if (optTitle)
+			printf("%s: ", rd->descStr);
+
+		printf("min %.*f%s max %.*f%s avg %.*f%s last %.*f%s n %d\n",
+			decimals, r[i].min, unit, decimals, r[i].max, unit,
+			avgDecimals, r[i].sum / r[i].count, unit, decimals, r[i].last, unit, r[i].count);
+	}
+}	// outputRollup
+
+/**********************************************************************
+	Add sample of meter m to its rollups, output closed windows.
+**********************************************************************/
+void updateRollups(meter_s_t *m, uint16_t *buf)
+{
+	readPlan_s_t *plan = m->plan;
+
+	if (! m->rollup)
+	{
+		m->rollup = calloc(countRollups * plan->countVisible, sizeof(*m->rollup));
+		m->rollupStart = calloc(countRollups, sizeof(*m->rollupStart));
+
+		if (! m->rollup || ! m->rollupStart)
+		{
+			printf("updateRollups malloc failed\n");
+			abort();
+		}
+	}
+
+	for (int w = 0; w < countRollups; w++)
+	{
+		rollup_s_t *r = m->rollup + w * plan->countVisible;
+		time_t start = windowStart(m->time.wallStart.tv_sec, rollupWindows[w]);
+
+		if (start != m->rollupStart[w])
+		{
+			if (m->rollupStart[w])
+				outputRollup(m, w, r);
+
+			memset(r, 0, plan->countVisible * sizeof(*r));
+			m->rollupStart[w] = start;
+		}
+
+		for (int i = 0; i < plan->countVisible; i++)
+		{
+			regDef_s_t *rd = plan->item[i].rd;
+			double v = mbc_value(rd->regType, rd->regBase10, buf + plan->item[i].offset);
+
+			if (isnan(v) || (m->present && (! m->present[i])))
+				continue;
+
+			if ((r[i].count == 0) || (v < r[i].min))
+				r[i].min = v;
+			if ((r[i].count == 0) || (v > r[i].max))
+				r[i].max = v;
+			r[i].sum += v;
+			r[i].last = v;
+			r[i].count++;
+		}
+	}
+}	// updateRollups
+
+/**********************************************************************
+	Rolling demand
+	Average of Power Total over the demand interval of the meter,
+	sliding by its slide time (0xF500), computed from the samples
+	instead of reading the 10 register max demand blocks. Power is held
+	from one sample to the next and integrated into one bucket per
+	slide, a slide boundary closes a window. The meter's current month
+	max demand (0xFA01) is read once per demandCheckSec to compare.
+**********************************************************************/
+int setupDemand(meter_s_t *m, int period)
+{
+	demandState_s_t *st = &m->demand;
+	uint16_t dest[2];
+
+	if (readMeterRegisters(m, 0xF500, 2, dest) == -1)
+	{
+		printf("%s: read demand interval failed: %s\n", m->name, modbus_strerror(errno));
+		return(-1);
+	}
+
+	st->intervalSec = MBC_BCD2INT(dest[0] >> 8) * 60;
+	st->slideSec = MBC_BCD2INT(dest[0] & 0xFF) * 60;
+
+	if ((st->slideSec <= 0) || (st->intervalSec < st->slideSec) || (st->intervalSec % st->slideSec))
+	{
+		printf("%s: invalid demand interval / slide time %04X.\n", m->name, dest[0]);
+		st->intervalSec = 0;
+		return(-1);
+	}
+
+	st->countSlides = st->intervalSec / st->slideSec;
+	if (! (st->slideEnergy = realloc(st->slideEnergy, st->countSlides * sizeof(*st->slideEnergy))))
+	{
+		printf("setupDemand malloc failed\n");
+		abort();
+	}
+
+	st->lastTime = 0;		// start with next sample
+
+	if (verbose > 0)
+		printf("%s: demand interval %dmin, slide %dmin\n", m->name, st->intervalSec / 60, st->slideSec / 60);
+
+	if (period > st->slideSec)
+		printf("Warning: %s: poll period %ds is longer than demand slide %dmin, power is held over slides.\n",
+			m->name, period, st->slideSec / 60);
+
+	return(0);
+}	// setupDemand
+
+/**********************************************************************
+	Slide in progress is complete: output demand of the window ending
+	now and keep the peak of the month.
+**********************************************************************/
+void closeSlide(meter_s_t *m)
+{
+	demandState_s_t *st = &m->demand;
+	struct timespec end = { .tv_sec = st->slideStart + st->slideSec };
+	struct tm tm;
+
+	if (++st->closed >= st->countSlides)
+	{
+		double sum = 0;
+
+		for (int i = 0; i < st->countSlides; i++)
+			sum += st->slideEnergy[i];
+
+		double demand = sum / st->intervalSec;
+
+		localtime_r(&end.tv_sec, &tm);
+		if (tm.tm_mon != st->peakMonth)
+		{	// max demand of the meter restarts with the month too
+			st->peak = 0;
+			st->peakMonth = tm.tm_mon;
+		}
+
+		printValue(meterPrefix(m, &end), "Demand", demand, 4, "kW");
+
+		if (demand > st->peak)
+		{	// timestamp tells when the peak window ended
+			st->peak = demand;
+			printValue(meterPrefix(m, &end), "Peak Demand", demand, 4, "kW");
+		}
+	}
+
+	st->head = (st->head + 1) % st->countSlides;
+	st->slideEnergy[st->head] = 0;
+	st->slideStart = end.tv_sec;
+}	// closeSlide
+
+/**********************************************************************
+	Add sample of Power Total [kW] taken by meter m, polled every
+	period seconds. A gap is more than one slide or poll with slack
+	for the jitter of the sample time.
+**********************************************************************/
+void updateDemand(meter_s_t *m, double power, int period)
+{
+	demandState_s_t *st = &m->demand;
+	double now = m->time.wallStart.tv_sec + m->time.wallStart.tv_nsec / 1e9;
+
+	if ((! st->intervalSec) && setupDemand(m, period))
+		return;
+
+	if (isnan(power))
+		return;
+
+	double maxGap = 1.5 * ((period > st->slideSec) ? period : st->slideSec);
+
+	if ((st->lastTime <= 0) || (now < st->lastTime) || (now - st->lastTime > maxGap))
+	{	// first sample or gap, held power would be made up
+		if (st->lastTime > 0)
+			printf("%s: demand restarted after gap of %.0fs\n", m->name, now - st->lastTime);
+
+		memset(st->slideEnergy, 0, st->countSlides * sizeof(*st->slideEnergy));
+		st->head = 0;
+		st->closed = -1;		// slide in progress started before the sample
+		st->slideStart = windowStart((time_t) now, st->slideSec);
+		st->lastTime = now;
+		st->lastPower = power;
+		return;
+	}
+
+	while (st->lastTime < now)
+	{
+		double end = st->slideStart + st->slideSec;
+		double seg = ((now < end) ? now : end) - st->lastTime;
+
+		st->slideEnergy[st->head] += st->lastPower * seg;
+		st->lastTime += seg;
+
+		if (st->lastTime >= end)
+			closeSlide(m);
+	}
+	st->lastPower = power;
+
+	if ((optDemandAlarm > 0) && (st->closed >= st->countSlides - 1))
+	{	// window ending now, shorter by the part of the oldest slide gone
+		double sum = 0;
+		double covered = (st->countSlides - 1) * st->slideSec + (now - st->slideStart);
+
+		for (int i = 0; i < st->countSlides; i++)
+			sum += st->slideEnergy[i];
+
+		double live = sum / covered;
+
+		if ((! st->alarm) && (live > optDemandAlarm))
+		{
+			st->alarm = 1;
+			printValue(samplePrefix(m), "Demand Alarm", live, 4, "kW");
+		}
+		else if (st->alarm && (live < optDemandAlarm * 0.95))
+		{	// 5% hysteresis
+			st->alarm = 0;
+			printValue(samplePrefix(m), "Demand Alarm Cleared", live, 4, "kW");
+		}
+	}
+}	// updateDemand
+
+/**********************************************************************
+	Compare local peak with max demand of the meter, the local peak
+	can only be lower if polling started later in the month.
+**********************************************************************/
+void checkDemand(meter_s_t *m)
+{
+	demandState_s_t *st = &m->demand;
+	regDef_s_t *rd = lookupRegDef(0xFA01);
+	uint16_t dest[10];
+
+	if ((st->closed < st->countSlides) || (m->time.wallStart.tv_sec - st->checkTime < demandCheckSec) || (! rd))
+		return;
+
+	st->checkTime = m->time.wallStart.tv_sec;
+
+	if (readMeterRegisters(m, rd->regNr, rd->regLen, dest) == -1)
+	{
+		printf("%s: read max demand failed: %s\n", m->name, modbus_strerror(errno));
+		return;
+	}
+
+	double meterMax = mbc_value(rd->regType, rd->regBase10, dest);
+
+	printValue(samplePrefix(m), "Meter Max Demand", meterMax, 4, "kW");
+
+	if (st->peak > meterMax * 1.02 + 0.001)
+		printf("%s: local peak demand %.4fkW above meter max demand %.4fkW, check poll period and slide time\n",
+			m->name, st->peak, meterMax);
+}	// checkDemand
+
+/**********************************************************************
+	Time the plan occupies the bus for one meter: request, response,
+	silence and meter turnaround for every block.
+**********************************************************************/
+long estimatePlanUsec(readPlan_s_t *plan)
+{
+	int bits = 1 + serialDataBits + (serialParity != 'N') + serialStopBits;
+	long charUsec = 1000000L * bits / serialBaud;
+	long usec = 0;
+
+	for (int b = 0; b < plan->countBlocks; b++)
+		usec += (8 + 5 + 2 * plan->block[b].blkLen) * charUsec + 2 * charUsec * 7 / 2 + defaultTurnaroundUsec;
+
+	return usec;
+}	// estimatePlanUsec
+
+/**********************************************************************
+	Next wall clock boundary of period [s] in local time, plus offset.
+**********************************************************************/
+struct timespec nextBoundary(int period, long offsetUsec)
+{
+	struct timespec now, ts;
+	struct tm tm;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	localtime_r(&now.tv_sec, &tm);
+
+	time_t local = now.tv_sec + tm.tm_gmtoff;
+
+	ts.tv_sec = (local / period + 1) * period - tm.tm_gmtoff + offsetUsec / 1000000;
+	ts.tv_nsec = (offsetUsec % 1000000) * 1000;
+
+	return ts;
+}	// nextBoundary
+
+/**********************************************************************
+**********************************************************************/
+void daemonSignal(int sig)
+{
+	if (sig == SIGHUP)
+		daemonReload = 1;
+	else
+		daemonStop = 1;
+}	// daemonSignal
+
+/**********************************************************************
+	Reconnect
+	A gone device is closed and its meters fail without bus traffic.
+	The directory of the device (udev symlink) is watched by inotify,
+	the daemon sleeps on it and reopens the device as soon as it
+	reappears, so polling resumes with the next slot of the plan.
+**********************************************************************/
+void watchDevice(const char *device)
+{
+	char dir[PATH_MAX];
+
+	if ((deviceWatchFd < 0) && ((deviceWatchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0))
+	{
+		printf("inotify_init failed: %s\n", strerror(errno));
+		return;
+	}
+
+	snprintf(dir, sizeof(dir), "%s", device);
+
+	// same directory again returns the existing watch
+	if (inotify_add_watch(deviceWatchFd, dirname(dir), IN_CREATE | IN_MOVED_TO | IN_ATTRIB) < 0)
+		printf("Watch %s failed: %s\n", dir, strerror(errno));
+}	// watchDevice
+
+/**********************************************************************
+	Find gone devices after a poll. The -nb transport notices hangup
+	itself, a failed libmodbus read is checked on its fd.
+**********************************************************************/
+void checkDevices(int failed)
+{
+	if (ctx && (! ctxDead) && failed)
+	{
+		struct pollfd pfd = { .fd = modbus_get_socket(ctx), .events = 0 };
+
+		if ((poll(&pfd, 1, 0) > 0) && (pfd.revents & (POLLHUP | POLLERR | POLLNVAL)))
+		{
+			printf("Device %s gone\n", serialDevice);
+			modbus_close(ctx);
+			ctxDead = 1;
+			watchDevice(serialDevice);
+		}
+	}
+
+	for (int b = 0; b < countBuses; b++)
+		if (buses[b]->dead)
+			watchDevice(buses[b]->device);
+}	// checkDevices
+
+/**********************************************************************
+	Try to reopen gone devices, returns number still gone.
+**********************************************************************/
+int reconnectDevices(void)
+{
+	int gone = 0;
+
+	if (ctxDead)
+	{
+		if ((access(serialDevice, F_OK) == 0) && (modbus_connect(ctx) == 0))
+		{
+			ioctl(modbus_get_socket(ctx), TIOCEXCL);
+			ctxDead = 0;
+			printf("Device %s reconnected\n", serialDevice);
+			if (optLowLatency || optRs485)
+				lowLatencySerial(modbus_get_socket(ctx), serialDevice);
+		}
+		else
+			gone++;
+	}
+
+	for (int b = 0; b < countBuses; b++)
+	{
+		if (! buses[b]->dead)
+			continue;
+
+		if ((access(buses[b]->device, F_OK) == 0) && (rtuReconnect(buses[b]) == 0))
+		{
+			printf("Device %s reconnected\n", buses[b]->device);
+			if (optLowLatency || optRs485)
+				lowLatencySerial(buses[b]->fd, buses[b]->device);
+		}
+		else
+			gone++;
+	}
+
+	return(gone);
+}	// reconnectDevices
+
+/**********************************************************************
+	Sleep until ts, with gone devices waiting for them meanwhile.
+**********************************************************************/
+void daemonSleep(struct timespec *ts)
+{
+	int gone = reconnectDevices();
+
+	while ((! daemonStop) && gone)
+	{
+		struct timespec now;
+		struct pollfd pfd = { .fd = deviceWatchFd, .events = POLLIN };
+		char events[4096];
+		long msec;
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		msec = (ts->tv_sec - now.tv_sec) * 1000 + (ts->tv_nsec - now.tv_nsec) / 1000000;
+		if (msec <= 0)
+			return;
+
+		if (poll(&pfd, 1, msec) <= 0)
+			continue;		// timeout or signal
+
+		while (read(deviceWatchFd, events, sizeof(events)) > 0)
+			;
+
+		gone = reconnectDevices();
+	}
+
+	while ((clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, ts, NULL) == EINTR) && (! daemonStop))
+		;
+}	// daemonSleep
+
+/**********************************************************************
+	Register cache
+	With -cache the daemon keeps the last value of every catalog
+	register per meter, from its polls and with -readAhead from reads
+	in the idle time before the next slot, stalest register first. A
+	read-ahead is only started if it ends before the slot even if the
+	meter does not answer. The cache file is rewritten after every
+	slot; mbc -cache without -d reads the plan from it instead of the
+	bus, which belongs to the daemon.
+**********************************************************************/
+void setupCache(void)
+{
+	if (cacheOffset)
+		return;
+
+	cacheOffset = malloc(countRegBlocks * sizeof(*cacheOffset));
+	cacheSplit = calloc(countRegBlocks, sizeof(*cacheSplit));
+	if ((! cacheOffset) || (! cacheSplit))
+	{
+		printf("setupCache malloc failed\n");
+		abort();
+	}
+
+	for (int b = 0; b < countRegBlocks; b++)
+	{
+		cacheOffset[b] = cacheLen;
+		cacheLen += regBlock[b].blkLen;
+	}
+}	// setupCache
+
+/**********************************************************************
+**********************************************************************/
+uint16_t *cacheSlot(meter_s_t *m, regDef_s_t *rd)
+{
+	if (! m->cache)
+	{
+		m->cache = calloc(cacheLen, sizeof(*m->cache));
+		m->cacheTime = calloc(countRegDef, sizeof(*m->cacheTime));
+		m->tryTime = calloc(countRegDef, sizeof(*m->tryTime));
+
+		if ((! m->cache) || (! m->cacheTime) || (! m->tryTime))
+		{
+			printf("cacheSlot malloc failed\n");
+			abort();
+		}
+	}
+
+	return m->cache + cacheOffset[rd->regBlock] + (rd->regNr - regBlock[rd->regBlock].blkNr);
+}	// cacheSlot
+
+/**********************************************************************
+	Keep catalog registers completely within len registers at addr.
+**********************************************************************/
+void cacheStore(meter_s_t *m, unsigned int addr, int len, uint16_t *src, time_t t)
+{
+	for (unsigned int r = addr; r < addr + len; )
+	{
+		regDef_s_t *rd = lookupRegDef(r);
+
+		if ((! rd) || (rd->regBlock < 0) || (r + rd->regLen > addr + len))
+		{
+			r++;
+			continue;
+		}
+
+		memcpy(cacheSlot(m, rd), src + (r - addr), rd->regLen * sizeof(*src));
+		m->cacheTime[rd - regDef] = t;
+		r += rd->regLen;
+	}
+}	// cacheStore
+
+/**********************************************************************
+	Keep all registers of a plan sample.
+**********************************************************************/
+void cacheSample(meter_s_t *m, readPlan_s_t *plan, uint16_t *buf)
+{
+	for (int i = 0; i < plan->countItems; i++)
+		if ((! m->present) || m->present[i])
+			cacheStore(m, plan->item[i].rd->regNr, plan->item[i].rd->regLen, buf + plan->item[i].offset, m->time.wallStart.tv_sec);
+}	// cacheSample
+
+/**********************************************************************
+	Write cache of all meters, one line per register:
+	<device> <slave> <register> <unix time> <hex words>
+**********************************************************************/
+int writeCache(void)
+{
+	char tmp[PATH_MAX];
+	FILE *fp;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", optCacheFile);
+
+	if (! (fp = fopen(tmp, "w")))
+	{
+		printf("Open cache file '%s' failed: %s\n", tmp, strerror(errno));
+		return(-1);
+	}
+
+	for (meter_s_t *m = meters; m; m = m->next)
+	{
+		for (int i = 0; m->cache && (i < countRegDef); i++)
+		{
+			regDef_s_t *rd = &regDef[i];
+			uint16_t *v;
+
+			if (! m->cacheTime[i])
+				continue;
+
+			v = cacheSlot(m, rd);
+			fprintf(fp, "%s %d 0x%04X %ld", m->device, m->slave, rd->regNr, (long) m->cacheTime[i]);
+			for (int j = 0; j < rd->regLen; j++)
+				fprintf(fp, " %04X", v[j]);
+			fprintf(fp, "\n");
+		}
+	}
+
+	// readers never see a partly written file
+	if ((fclose(fp) != 0) || (rename(tmp, optCacheFile) != 0))
+	{
+		printf("Write cache file '%s' failed: %s\n", optCacheFile, strerror(errno));
+		return(-1);
+	}
+
+	return(0);
+}	// writeCache
+
+/**********************************************************************
+	Read-ahead of the stalest register of all meters, or its catalog
+	block, if it ends before the slot at ts. Returns 0 if one was
+	read, -1 if nothing is due or there is no time left.
+**********************************************************************/
+int readAheadOne(struct timespec *ts)
+{
+	meter_s_t *best = NULL;
+	int bestReg = -1;
+	time_t bestAge = 0;
+	time_t now = time(NULL);
+
+	for (meter_s_t *m = meters; m; m = m->next)
+	{
+		if ((m->bus && m->bus->dead) || ((! m->bus) && ctxDead))
+			continue;
+
+		for (int i = 0; i < countRegDef; i++)
+		{
+			time_t last;
+
+			if ((regDef[i].regBlock < 0) || (! modelHas(m->model, regDef[i].regNr)))
+				continue;
+
+			cacheSlot(m, &regDef[i]);
+			last = (m->cacheTime[i] > m->tryTime[i]) ? m->cacheTime[i] : m->tryTime[i];
+
+			if ((now - last >= optReadAhead) && ((! best) || (now - last > bestAge)))
+			{
+				best = m;
+				bestReg = i;
+				bestAge = now - last;
+			}
+		}
+	}
+
+	if (! best)
+		return(-1);
+
+	regDef_s_t *rd = &regDef[bestReg];
+	regBlock_s_t *blk = &regBlock[rd->regBlock];
+	char single = cacheSplit[rd->regBlock];
+	uint16_t dest[MODBUS_MAX_READ_REGISTERS];
+	struct timespec t;
+
+	for (int r = blk->blkNr; r < blk->blkNr + blk->blkLen; r++)
+		if (! modelHas(best->model, r))
+			single = 1;		// block includes registers the model does not have
+
+	unsigned int addr = single ? rd->regNr : blk->blkNr;
+	int len = single ? rd->regLen : blk->blkLen;
+
+	// worst case: meter silent until response timeout
+	clock_gettime(CLOCK_REALTIME, &t);
+	if ((ts->tv_sec - t.tv_sec) * 1000000L + (ts->tv_nsec - t.tv_nsec) / 1000
+		< frameUsec(8) + responseTimeoutUsec() + frameUsec(5 + 2 * len))
+		return(-1);
+
+	best->tryTime[bestReg] = now;
+
+	if (readMeterRegisters(best, addr, len, dest) == len)
+		cacheStore(best, addr, len, dest, now);
+	else if (((errno == EMBXILADD) || (errno == EMBXILVAL)) && (addr != rd->regNr || len != rd->regLen))
+		cacheSplit[rd->regBlock] = 1;	// single registers from now on
+	else if (verbose > 1)
+		printf("Read-ahead %s %04X, %d failed: %s\n", best->name, addr, len, modbus_strerror(errno));
+
+	if (verbose > 2)
+		printf("Read-ahead %s %04X, %d, age %lds\n", best->name, addr, len, (long) bestAge);
+
+	return(0);
+}	// readAheadOne
+
+/**********************************************************************
+	Use bus time until the slot at ts for read-ahead.
+**********************************************************************/
+void readAhead(struct timespec *ts)
+{
+	int count = 0;
+
+	while ((! daemonStop) && (! daemonReload) && (readAheadOne(ts) == 0))
+		count++;
+
+	if (count)
+		writeCache();
+}	// readAhead
+
+/**********************************************************************
+	Fill plan buffers of count meters of due[] from cache file.
+	Returns number of meters with missing or stale registers.
+**********************************************************************/
+int cachePlan(readPlan_s_t *plan, meter_s_t **due, int count)
+{
+	FILE *fp = fopen(optCacheFile, "r");
+	char line[1024];
+	time_t now = time(NULL);
+	int failed = 0;
+
+	if (! fp)
+	{
+		printf("Open cache file '%s' failed: %s\n", optCacheFile, strerror(errno));
+		return(count);
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		bindMeter(due[i], plan);
+		due[i]->failed = 0;
+	}
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		char device[PATH_MAX];
+		int slave, n;
+		unsigned int reg;
+		long t;
+		char *cp;
+
+		if (sscanf(line, "%s %d %i %ld%n", device, &slave, &reg, &t, &n) != 4)
+			continue;
+
+		for (int i = 0; i < count; i++)
+		{
+			meter_s_t *m = due[i];
+			regDef_s_t *rd = lookupRegDef(reg);
+
+			if ((m->slave != slave) || strcmp(device, m->device) || (! rd) || (rd->regBlock < 0))
+				continue;
+
+			cp = line + n;
+			for (int j = 0; j < rd->regLen; j++)
+				cacheSlot(m, rd)[j] = strtol(cp, &cp, 16);
+			m->cacheTime[rd - regDef] = t;
+		}
+	}
+	fclose(fp);
+
+	for (int i = 0; i < count; i++)
+	{
+		meter_s_t *m = due[i];
+		time_t oldest = now;
+
+		for (int j = 0; j < plan->countItems; j++)
+		{
+			regDef_s_t *rd = plan->item[j].rd;
+
+			if (m->present && (! m->present[j]))
+				continue;
+
+			if ((! m->cache) || (! m->cacheTime[rd - regDef])
+				|| (optMaxAge && (now - m->cacheTime[rd - regDef] > optMaxAge)))
+			{
+				printf("%s: register %04X not in cache%s\n", m->name, rd->regNr, optMaxAge ? " or too old" : "");
+				m->failed = -1;
+				continue;
+			}
+
+			memcpy(meterBuf(m) + plan->item[j].offset, cacheSlot(m, rd), rd->regLen * sizeof(uint16_t));
+			if (m->cacheTime[rd - regDef] < oldest)
+				oldest = m->cacheTime[rd - regDef];
+		}
+
+		// sample time is the oldest value used
+		m->time.wallStart.tv_sec = m->time.wallEnd.tv_sec = oldest;
+		m->time.wallStart.tv_nsec = m->time.wallEnd.tv_nsec = 0;
+
+		if (m->failed)
+			failed++;
+	}
+
+	return(failed);
+}	// cachePlan
+
+/**********************************************************************
+	Plans reading the same registers into the same buffer layout.
+**********************************************************************/
+int samePlan(readPlan_s_t *a, readPlan_s_t *b)
+{
+	if ((a->layout != b->layout) || (a->countItems != b->countItems)
+		|| (a->countVisible != b->countVisible) || (a->countBlocks != b->countBlocks))
+		return 0;
+
+	for (int i = 0; i < a->countItems; i++)
+		if (a->item[i].rd != b->item[i].rd)
+			return 0;
+
+	return 1;
+}	// samePlan
+
+/**********************************************************************
+	Daemon settings from the effective options and plan base.
+**********************************************************************/
+int setupDaemon(daemon_s_t *d, readPlan_s_t *base)
+{
+	meter_s_t *m;
+
+	d->base = base;
+	d->period = optDaemon;
+
+	if (d->period < 0)
+	{	// demand interval of first meter
+		uint16_t dest[2];
+
+		if (readMeterRegisters(meters, 0xF500, 2, dest) == -1)
+		{
+			printf("Read demand interval failed: %s\n", modbus_strerror(errno));
+			return(-1);
+		}
+		d->period = MBC_BCD2INT(dest[0] >> 8) * 60;
+
+		if (d->period <= 0)
+		{
+			printf("Invalid demand interval %04X.\n", dest[0]);
+			return(-1);
+		}
+	}
+
+	if (! (d->plan = preparePlan(base)))
+		return(-1);
+
+	d->clockItem = optCheckDate ? findPlanItem(d->plan, 0xF000) : -1;
+	d->plan->stampItem = d->clockItem;
+	d->powerItem = optDemand ? findPlanItem(d->plan, 0x0096) : -1;
+
+	setupDerivedPlan(d->plan, &d->dp);
+
+	d->stagger = (optStaggerUsec >= 0) ? optStaggerUsec : estimatePlanUsec(d->plan);
+
+	d->maxBusIndex = 0;
+	for (m = meters; m; m = m->next)
+		if (m->busIndex > d->maxBusIndex)
+			d->maxBusIndex = m->busIndex;
+
+	if (verbose > 0)
+		printf("Daemon: period %ds, stagger %ldms, %d meters\n", d->period, d->stagger / 1000, countMeters);
+
+	if ((d->maxBusIndex + 1) * d->stagger > d->period * 1000000L)
+		printf("Warning: %d meters need %ldms, more than period of %ds.\n", d->maxBusIndex + 1, (d->maxBusIndex + 1) * d->stagger / 1000, d->period);
+
+	for (int w = 0; w < countRollups; w++)
+		if (rollupWindows[w] % d->period)
+			printf("Warning: rollup window %ds is not a multiple of period %ds.\n", rollupWindows[w], d->period);
+
+	return(0);
+}	// setupDaemon
+
+/**********************************************************************
+	SIGHUP: reload config file between two cycles. The new plan is
+	used from the next cycle on, on any error the old one is kept.
+	Buses stay open, meters and unchanged plans keep their state.
+**********************************************************************/
+void reloadDaemon(daemon_s_t *d)
+{
+	config_s_t cfg;
+	readPlan_s_t *base = d->base;
+	daemon_s_t nd;
+	int *oldWindows = rollupWindows;
+	int oldCount = countRollups;
+
+	if (! optConfigFile)
+	{
+		printf("Reload: no config file\n");
+		return;
+	}
+
+	if (loadConfig(optConfigFile, &cfg))
+	{
+		printf("Reload: config file invalid, keeping current configuration\n");
+		freeConfig(&cfg);
+		return;
+	}
+
+	if (cmdline.report || (! optRegsToDump))
+	{	// else -r is polled
+		const char *name = cmdline.report ? cmdline.report : cfg.report;
+
+		if ((! name) || (! (base = findReport(&cfg.reports, name))))
+		{
+			printf("Reload: unknown or invalid report '%s', keeping current configuration\n", name ? name : "");
+			freeConfig(&cfg);
+			return;
+		}
+	}
+
+	if (cfg.device && (! cmdline.device) && strcmp(cfg.device, config.device ? config.device : defaultSerialDevice))
+		printf("Reload: device change needs a restart, ignored\n");
+
+	if (! (cmdline.period || cfg.period))
+	{
+		printf("Reload: no period, keeping current configuration\n");
+		freeConfig(&cfg);
+		return;
+	}
+
+	applyConfig(&cfg);
+	syncMeters();
+	setupModels();
+
+	if (setupDaemon(&nd, base))
+	{
+		printf("Reload: keeping current configuration\n");
+		applyConfig(&config);
+		syncMeters();
+		setupModels();
+		freeConfig(&cfg);
+		return;
+	}
+
+	if (samePlan(nd.plan, d->plan))
+	{	// keep buffers, csv header and split blocks of the meters
+		for (int b = 0; b < nd.plan->countBlocks; b++)
+			nd.plan->block[b].split = d->plan->block[b].split;
+		nd.plan->headerDone = d->plan->headerDone;
+
+		for (meter_s_t *m = meters; m; m = m->next)
+		{
+			if (m->plan != d->plan)
+				continue;
+
+			m->plan = nd.plan;
+			if (m->run)
+				m->run->plan = nd.plan;
+		}
+	}
+	else
+	{	// rebound with next poll
+		for (meter_s_t *m = meters; m; m = m->next)
+			bindMeter(m, NULL);
+	}
+
+	if ((countRollups != oldCount)
+		|| (countRollups && memcmp(rollupWindows, oldWindows, countRollups * sizeof(*rollupWindows))))
+		for (meter_s_t *m = meters; m; m = m->next)
+			resetRollups(m);
+
+	if (ctx)
+	{
+		modbus_set_response_timeout(ctx, responseTimeoutUsec() / 1000000, responseTimeoutUsec() % 1000000);
+		modbus_set_byte_timeout(ctx, byteTimeoutUsec() / 1000000, byteTimeoutUsec() % 1000000);
+	}
+
+	if (d->plan != d->base)
+		freeReadPlan(d->plan);
+
+	if (optSink && sinkSetup(optSink, optSpool))
+		printf("Reload: sink keeps %s\n", sink.target ? sink.target : "stdout");
+	else if ((! optSink) && sink.target)
+	{	// back to stdout, hand over what is left
+		sinkFlush(1);
+		sinkClose();
+		free(sink.target);
+		sink.target = NULL;
+	}
+
+	freeConfig(&config);
+	config = cfg;
+	*d = nd;
+
+	printf("Reload: %s, %d meters, period %ds\n", d->base->name, countMeters, d->period);
+}	// reloadDaemon
+
+/**********************************************************************
+	Poll plan on all meters aligned to wall clock boundaries of the
+	period. Meters on the same bus are staggered, meters on different
+	buses are polled at the same time.
+**********************************************************************/
+void runDaemon(readPlan_s_t *plan)
+{
+	daemon_s_t d;
+	meter_s_t **due = NULL;
+	meter_s_t *m;
+
+	signal(SIGINT, daemonSignal);
+	signal(SIGTERM, daemonSignal);
+	signal(SIGHUP, daemonSignal);
+
+	if (setupDaemon(&d, plan))
+		exit(-1);
+
+	if (optSink && sinkSetup(optSink, optSpool))
+		exit(-1);
+
+	while (! daemonStop)
+	{
+		if (daemonReload)
+		{
+			daemonReload = 0;
+			reloadDaemon(&d);
+		}
+
+		if (! (due = realloc(due, countMeters * sizeof(*due))))
+		{
+			printf("runDaemon malloc failed\n");
+			abort();
+		}
+
+		struct timespec boundary = nextBoundary(d.period, 0);
+
+		for (int k = 0; (k <= d.maxBusIndex) && (! daemonStop); k++)
+		{
+			struct timespec ts = boundary;
+			int count = 0;
+
+			ts.tv_sec += (k * d.stagger) / 1000000;
+			ts.tv_nsec += ((k * d.stagger) % 1000000) * 1000;
+			if (ts.tv_nsec >= 1000000000L)
+			{
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+
+			if (optReadAhead)
+				readAhead(&ts);
+
+			daemonSleep(&ts);
+			if (daemonStop)
+				break;
+
+			for (m = meters; m; m = m->next)
+				if (m->busIndex == k)
+					due[count++] = m;
+
+			checkDevices(pollMeters(d.plan, due, count));
+
+			for (int i = 0; i < count; i++)
+			{
+				double derived[countDerived];
+
+				if (due[i]->failed)
+					continue;
+
+				if (optDerived)
+					computeDerived(due[i], d.plan, &d.dp, meterBuf(due[i]), derived);
+
+				if (countRollups)
+				{	// derived values of every sample
+					updateRollups(due[i], meterBuf(due[i]));
+					if (optDerived && sink.target)
+						sinkSample(due[i], d.plan, NULL, NULL, derived);
+					else if (optDerived)
+						outputDerived(samplePrefix(due[i]), derived);
+				}
+				else if (countDeadbands && (! changedItems(due[i], d.plan, meterBuf(due[i]))))
+					continue;
+				else if (sink.target)
+					sinkSample(due[i], d.plan, meterBuf(due[i]), countDeadbands ? due[i]->emitted : NULL, optDerived ? derived : NULL);
+				else
+					outputReadPlan(d.plan, meterBuf(due[i]), samplePrefix(due[i]), countDeadbands ? due[i]->emitted : NULL, due[i]->present, optDerived ? derived : NULL);
+			}
+
+			for (int i = 0; (d.powerItem >= 0) && (i < count); i++)
+			{
+				if (due[i]->failed)
+					continue;
+
+				updateDemand(due[i], planValue(d.plan, meterBuf(due[i]), d.powerItem), d.period);
+				checkDemand(due[i]);
+			}
+
+			for (int i = 0; (d.clockItem >= 0) && (i < count); i++)
+				if (! due[i]->failed)
+					checkMeterClock(due[i], meterBuf(due[i]) + d.plan->item[d.clockItem].offset, &due[i]->clockTime);
+
+			if (optCacheFile)
+			{
+				for (int i = 0; i < count; i++)
+					if (! due[i]->failed)
+						cacheSample(due[i], d.plan, meterBuf(due[i]));
+				writeCache();
+			}
+
+			fflush(stdout);
+		}
+
+		// batch would get too old waiting for the next cycle
+		sinkFlush(mbc_usec_since(&sink.batchStart) + d.period * 1000000L >= optFlushUsec);
+	}
+
+	sinkFlush(1);
+	free(due);
+
+	if (verbose > 0)
+		printf("Daemon: stopped\n");
+}	// runDaemon
+
+/**********************************************************************
+	-batch: commands from stdin or a file, one per line, run in order
+	on the open connection, each answered by one line:
+		-r list		ok;value;...  failed;...  error;reason
+		-R name		same, with the registers of the report
+		-setDate	ok  failed
+	With several meters the values of each follow its name, "-" if
+	its read failed. Reads already waiting in the input are merged
+	into one read plan. A FIFO is reopened for the next writer.
+**********************************************************************/
+typedef struct {
+	int fd;
+	int len;
+	char buf[4096];
+} batchInput_s_t;
+
+typedef struct {
+	char kind;				// 'r' read, 'D' -setDate, 'e' error
+	unsigned int *regs;
+	int count;
+	char error[128];
+} batchCmd_s_t;
+
+/**********************************************************************
+	Next line of input, 1 if got one, 0 if none waiting and ! wait,
+	-1 at end of input.
+**********************************************************************/
+int batchLine(batchInput_s_t *in, char *line, int size, char wait)
+{
+	for (;;)
+	{
+		char *nl = memchr(in->buf, '\n', in->len);
+
+		if (nl || (in->len == sizeof(in->buf)))
+		{	// overlong lines are split
+			int n = nl ? nl - in->buf : in->len;
+			int copy = (n < size - 1) ? n : size - 1;
+
+			memcpy(line, in->buf, copy);
+			line[copy] = '\0';
+
+			n += (nl != NULL);
+			memmove(in->buf, in->buf + n, in->len - n);
+			in->len -= n;
+			return(1);
+		}
+
+		if (! wait)
+		{
+			struct pollfd pfd = { .fd = in->fd, .events = POLLIN };
+
+			if (poll(&pfd, 1, 0) <= 0)
+				return(0);
+		}
+
+		ssize_t n = read(in->fd, in->buf + in->len, sizeof(in->buf) - in->len);
+
+		if ((n < 0) && (errno == EINTR))
+			continue;
+
+		if (n <= 0)
+		{	// last line may lack its newline
+			if (! in->len)
+				return(-1);
+			in->buf[in->len++] = '\n';
+			continue;
+		}
+
+		in->len += n;
+	}
+}	// batchLine
+
+/**********************************************************************
+**********************************************************************/
+void parseBatchCmd(char *line, batchCmd_s_t *cmd)
+{
+	char *name = strtok(line, " \t\r");
+	char *arg = strtok(NULL, " \t\r");
+	char *extra = strtok(NULL, " \t\r");
+
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->kind = 'e';
+
+	if ((strcmp(name, "-r") == 0) && arg && (! extra))
+	{
+		cmd->count = parseRegList(arg, &cmd->regs);
+
+		for (int i = 0; i < cmd->count; i++)
+		{
+			regDef_s_t *rd = lookupRegDef(cmd->regs[i]);
+
+			if ((! rd) || (rd->regBlock < 0))
+			{
+				snprintf(cmd->error, sizeof(cmd->error), "%s register %04X", rd ? "Unreadable" : "Undefined", cmd->regs[i]);
+				return;
+			}
+		}
+
+		if (cmd->count)
+			cmd->kind = 'r';
+		else
+			snprintf(cmd->error, sizeof(cmd->error), "Empty register list");
+	}
+	else if ((strcmp(name, "-R") == 0) && arg && (! extra))
+	{
+		readPlan_s_t *plan = findReport(&config.reports, arg);
+
+		if (! plan)
+		{
+			snprintf(cmd->error, sizeof(cmd->error), "Unknown or invalid report '%s'", arg);
+			return;
+		}
+
+		if (! (cmd->regs = malloc(plan->countVisible * sizeof(*cmd->regs))))
+		{
+			printf("parseBatchCmd malloc failed\n");
+			abort();
+		}
+		for (cmd->count = 0; cmd->count < plan->countVisible; cmd->count++)
+			cmd->regs[cmd->count] = plan->item[cmd->count].rd->regNr;
+		cmd->kind = 'r';
+	}
+	else if ((strcmp(name, "-setDate") == 0) && (! arg))
+		cmd->kind = 'D';
+	else
+		snprintf(cmd->error, sizeof(cmd->error), "Unknown command '%s'", name);
+}	// parseBatchCmd
+
+/**********************************************************************
+	Diagnostics printed while a -batch command runs go to stderr,
+	stdout carries one result line per command. Returns the saved
+	stdout for batchResults().
+**********************************************************************/
+int batchDiagnostics(void)
+{
+	int saved;
+
+	fflush(stdout);
+	if ((saved = dup(STDOUT_FILENO)) >= 0)
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+
+	return(saved);
+}	// batchDiagnostics
+
+/**********************************************************************
+**********************************************************************/
+void batchResults(int saved)
+{
+	if (saved < 0)
+		return;
+
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+}	// batchResults
+
+/**********************************************************************
+	Read the registers of all commands with one plan, print the result
+	line of each. Returns number of failed commands.
+**********************************************************************/
+int batchReads(batchCmd_s_t *cmd, int count)
+{
+	unsigned int *regs = NULL;
+	int countRegs = 0, failed = 0;
+
+	if (! count)
+		return(0);
+
+	for (int c = 0; c < count; c++)
+	{
+		for (int k = 0; k < cmd[c].count; k++)
+		{
+			int i;
+
+			for (i = 0; (i < countRegs) && (regs[i] != cmd[c].regs[k]); i++)
+				;
+			if (i < countRegs)
+				continue;
+
+			if (! (regs = realloc(regs, (countRegs + 1) * sizeof(*regs))))
+			{
+				printf("batchReads realloc failed\n");
+				abort();
+			}
+			regs[countRegs++] = cmd[c].regs[k];
+		}
+	}
+
+	readPlan_s_t *plan = compileReadPlan("-batch", LAYOUT_CSV, regs, countRegs);
+	meter_s_t **due = malloc(countMeters * sizeof(*due));
+	int i = 0;
+
+	if ((! plan) || (! due))
+	{	// registers are checked by parseBatchCmd()
+		printf("batchReads failed\n");
+		abort();
+	}
+
+	for (meter_s_t *m = meters; m; m = m->next)
+		due[i++] = m;
+
+	int saved = batchDiagnostics();
+	pollMeters(plan, due, countMeters);
+	batchResults(saved);
+
+	for (int c = 0; c < count; c++)
+	{
+		int ok = 1;
+
+		for (i = 0; i < countMeters; i++)
+			if (due[i]->failed)
+				ok = 0;
+
+		printf("%s", ok ? "ok" : "failed");
+
+		if (optTimestamp)
+		{
+			struct tm tm;
+
+			localtime_r(&due[0]->time.wallStart.tv_sec, &tm);
+			strftime(dateNow, sizeof(dateNow), "%Y-%m-%d %H:%M:%S", &tm);
+			printf(";%s.%03ld", dateNow, due[0]->time.wallStart.tv_nsec / 1000000);
+		}
+
+		for (i = 0; i < countMeters; i++)
+		{
+			if (countMeters > 1)
+				printf(";%s", due[i]->name);
+
+			for (int k = 0; k < cmd[c].count; k++)
+			{
+				planItem_s_t *pi = &plan->item[findPlanItem(plan, cmd[c].regs[k])];
+
+				printf(";");
+				if (due[i]->failed || (due[i]->present && (! due[i]->present[pi - plan->item])))
+					printf("-");
+				else
+					printRegister(pi->rd, meterBuf(due[i]) + pi->offset, optTitle, "");
+			}
+		}
+
+		printf("\n");
+
+		if (! ok)
+			failed++;
+		free(cmd[c].regs);
+	}
+
+	for (i = 0; i < countMeters; i++)
+		bindMeter(due[i], NULL);	// the next plan may get the same address
+
+	freeReadPlan(plan);
+	free(regs);
+	free(due);
+
+	return failed;
+}	// batchReads
+
+/**********************************************************************
+	Run commands from file, stdin if NULL. Returns number of failed
+	commands.
+**********************************************************************/
+int runBatch(const char *fileName)
+{
+	batchInput_s_t in = { .fd = 0 };
+	batchCmd_s_t pending[batchMaxMerge];
+	int countPending = 0, failed = 0;
+	char line[1024];
+	struct stat st;
+	char fifo;
+
+	if (fileName && ((in.fd = open(fileName, O_RDONLY | O_CLOEXEC)) < 0))
+	{
+		printf("Open %s failed: %s\n", fileName, strerror(errno));
+		return(-1);
+	}
+
+	fifo = fileName && (fstat(in.fd, &st) == 0) && S_ISFIFO(st.st_mode);
+
+	for (;;)
+	{
+		int rc = batchLine(&in, line, sizeof(line), countPending == 0);
+
+		if (rc > 0)
+		{
+			batchCmd_s_t cmd;
+			char *cp = line + strspn(line, " \t\r");
+
+			if ((*cp == '#') || (*cp == '\0'))
+				continue;
+
+			parseBatchCmd(cp, &cmd);
+
+			if (cmd.kind == 'r')
+			{	// merged with the reads following it
+				pending[countPending++] = cmd;
+				if (countPending < batchMaxMerge)
+					continue;
+			}
+
+			failed += batchReads(pending, countPending);
+			countPending = 0;
+
+			switch (cmd.kind)
+			{
+			case 'D':
+			{
+				int saved = batchDiagnostics();
+
+				for (meter_s_t *m = meters; m; m = m->next)
+					setDate(m, NULL);
+				int rcWrite = flushWrites();
+				batchResults(saved);
+
+				if (rcWrite)
+				{
+					printf("failed\n");
+					failed++;
+				}
+				else
+					printf("ok\n");
+				break;
+			}
+			case 'e':
+				printf("error;%s\n", cmd.error);
+				free(cmd.regs);
+				failed++;
+				break;
+			}
+
+			fflush(stdout);
+			continue;
+		}
+
+		// input drained or ended
+		failed += batchReads(pending, countPending);
+		countPending = 0;
+		fflush(stdout);
+
+		if (rc == 0)
+			continue;
+
+		if (! fifo)
+			break;
+
+		// wait for the next writer
+		close(in.fd);
+		in.len = 0;
+		if ((in.fd = open(fileName, O_RDONLY | O_CLOEXEC)) < 0)
+		{
+			printf("Open %s failed: %s\n", fileName, strerror(errno));
+			return(failed + 1);
+		}
+	}
+
+	if (fileName)
+		close(in.fd);
+
+	return failed;
+}	// runBatch
+
+/**********************************************************************
+	-convert: decode archived cache files again with the current
+	catalog (-regDef), e.g. after a scale factor was corrected. Input
+	lines are those of -cache:
+		<device> <slave> <register> <unix time> <hex words>
+	output is one line per register as -d prints it:
+		<date time> <device>:<slave> [<description>: ]<value>[<unit>]
+	Files are cut into chunks at line boundaries, decoded by -threads
+	workers and merged in time order, equal times in input order. Each
+	worker owns a range of chunks and steals half of the rest of
+	another worker when its own range is done.
+**********************************************************************/
+typedef struct {
+	time_t t;
+	size_t off;				// in chunk output
+	size_t len;
+} convertRec_s_t;
+
+typedef struct {
+	int file;
+	off_t start, end;		// owns lines starting in [start, end)
+	char *out;
+	size_t outLen, outSize;
+	convertRec_s_t *rec;
+	int countRec, sizeRec;
+	int next;				// merge position
+} convertChunk_s_t;
+
+typedef struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	int head, tail;			// chunks [head, tail) left to this worker
+	time_t windowStart;		// local time of windowStart, see convertTime()
+	struct tm windowTm;
+	long lines, skipped, stolen;
+} convertWorker_s_t;
+
+struct {
+	int *fd;
+	off_t *size;
+	convertChunk_s_t *chunk;
+	int countChunks;
+	convertWorker_s_t *worker;
+	int countWorkers;
+} convert;
+
+/**********************************************************************
+	Local time of t as "yyyy-mm-dd hh:mm:ss". localtime_r() serializes
+	all threads on the time zone lock, time zone changes fall on full
+	quarter hours, so it is called once per quarter hour and worker.
+**********************************************************************/
+int convertTime(convertWorker_s_t *w, time_t t, char *buf, size_t size)
+{
+	struct tm tm;
+
+	if ((! w->windowStart) || (t < w->windowStart) || (t >= w->windowStart + 900))
+	{
+		w->windowStart = t - (t % 900);
+		localtime_r(&w->windowStart, &w->windowTm);
+		if ((w->windowTm.tm_min % 15) || w->windowTm.tm_sec)
+			w->windowStart = 0;		// offset not in quarter hours
+	}
+
+	if (w->windowStart)
+	{
+		tm = w->windowTm;
+		tm.tm_min += (t - w->windowStart) / 60;
+		tm.tm_sec = (t - w->windowStart) % 60;
+	}
+	else
+		localtime_r(&t, &tm);
+
+	return snprintf(buf, size, "%04d-%02d-%02d %02d:%02d:%02d",
+		tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}	// convertTime
+
+/**********************************************************************
+	Decode one input line into the chunk output, 0 if not a line of
+	a known register.
+**********************************************************************/
+int convertLine(convertWorker_s_t *w, convertChunk_s_t *c, char *line)
+{
+	uint16_t words[MBC_MAX_READ];
+	char value[1024];
+	char date[32];
+	char *device = line, *cp;
+	int slave, count = 0;
+	unsigned int reg;
+	time_t t;
+	regDef_s_t *rd;
+	size_t devLen;
+
+	if (! (cp = strchr(line, ' ')))
+		return(0);
+	devLen = cp - device;
+
+	slave = strtol(cp, &cp, 0);
+	reg = strtoul(cp, &cp, 0);
+	t = strtol(line = cp, &cp, 0);
+	if ((cp == line) || (! (rd = lookupRegDef(reg))) || (rd->regType == 0))
+		return(0);
+
+	while (count < MBC_MAX_READ)
+	{
+		char *end;
+		long v = strtol(cp, &end, 16);
+
+		if (end == cp)
+			break;
+		words[count++] = v;
+		cp = end;
+	}
+
+	if ((count < rd->regLen) || (mbc_format(rd->regType, rd->regBase10, rd->regLen, words, optUnit ? rd->unitStr : NULL, value, sizeof(value)) < 0))
+		return(0);
+
+	convertTime(w, t, date, sizeof(date));
+
+	if (c->outSize - c->outLen < devLen + strlen(rd->descStr) + sizeof(value) + 64)
+	{
+		c->outSize = (c->outSize + devLen + sizeof(value)) * 2;
+		if (! (c->out = realloc(c->out, c->outSize)))
+		{
+			printf("convertLine realloc failed\n");
+			abort();
+		}
+	}
+
+	if (c->countRec == c->sizeRec)
+	{
+		c->sizeRec = c->sizeRec ? 2 * c->sizeRec : 4096;
+		if (! (c->rec = realloc(c->rec, c->sizeRec * sizeof(*c->rec))))
+		{
+			printf("convertLine realloc failed\n");
+			abort();
+		}
+	}
+
+	c->rec[c->countRec].t = t;
+	c->rec[c->countRec].off = c->outLen;
+	c->outLen += snprintf(c->out + c->outLen, c->outSize - c->outLen, "%s.000 %.*s:%d %s%s%s\n",
+		date, (int) devLen, device, slave, optTitle ? rd->descStr : "", optTitle ? ": " : "", value);
+	c->rec[c->countRec].len = c->outLen - c->rec[c->countRec].off;
+	c->countRec++;
+
+	return(1);
+}	// convertLine
+
+/**********************************************************************
+	Records of a chunk by time, equal times in input order.
+**********************************************************************/
+int cmpConvertRec(const void *a, const void *b)
+{
+	const convertRec_s_t *ra = a, *rb = b;
+
+	if (ra->t != rb->t)
+		return (ra->t < rb->t) ? -1 : 1;
+
+	return (ra->off < rb->off) ? -1 : (ra->off > rb->off);
+}	// cmpConvertRec
+
+/**********************************************************************
+	Decode lines starting in the chunk. The byte before it tells if
+	the first line starts there or belongs to the chunk before.
+**********************************************************************/
+void convertChunk(convertWorker_s_t *w, convertChunk_s_t *c, char *buf)
+{
+	off_t from = c->start ? c->start - 1 : 0;
+	off_t to = c->end + convertMaxLine;
+	ssize_t n;
+	char *cp, *end, *nl;
+	char sorted = 1;
+
+	if (to > convert.size[c->file])
+		to = convert.size[c->file];
+
+	if ((n = pread(convert.fd[c->file], buf, to - from, from)) < 0)
+	{
+		printf("convertChunk read failed: %s\n", strerror(errno));
+		return;
+	}
+	end = buf + n;
+	cp = buf;
+
+	if (c->start && (! (cp = memchr(buf, '\n', n))))
+		return;					// all of it belongs to a line before
+	else if (c->start)
+		cp++;
+
+	while ((cp < end) && (from + (cp - buf) < c->end))
+	{
+		if (! (nl = memchr(cp, '\n', end - cp)))
+		{
+			if (from + n < convert.size[c->file])
+			{	// longer than any line of a cache file
+				w->skipped++;
+				break;
+			}
+			nl = end;			// last line without newline
+		}
+		*nl = '\0';
+
+		if (*cp)
+		{
+			w->lines++;
+			if (! convertLine(w, c, cp))
+				w->skipped++;
+			else if ((c->countRec > 1) && (c->rec[c->countRec - 1].t < c->rec[c->countRec - 2].t))
+				sorted = 0;
+		}
+
+		cp = nl + 1;
+	}
+
+	if (! sorted)
+		qsort(c->rec, c->countRec, sizeof(*c->rec), cmpConvertRec);
+}	// convertChunk
+
+/**********************************************************************
+	Next chunk of worker w, own range first, else half of the range
+	left to another worker. -1 if all are taken.
+**********************************************************************/
+int convertNext(convertWorker_s_t *w)
+{
+	int next = -1;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->head < w->tail)
+		next = w->head++;
+	pthread_mutex_unlock(&w->lock);
+
+	for (int i = 1; (next < 0) && (i < convert.countWorkers); i++)
+	{
+		convertWorker_s_t *v = &convert.worker[(w - convert.worker + i) % convert.countWorkers];
+		int head = 0, tail = 0;
+
+		pthread_mutex_lock(&v->lock);
+		if (v->head < v->tail)
+		{
+			head = v->tail - (v->tail - v->head + 1) / 2;
+			tail = v->tail;
+			v->tail = head;
+		}
+		pthread_mutex_unlock(&v->lock);
+
+		if (head == tail)
+			continue;
+
+		w->stolen += tail - head;
+		pthread_mutex_lock(&w->lock);
+		w->head = head + 1;
+		w->tail = tail;
+		pthread_mutex_unlock(&w->lock);
+		next = head;
+	}
+
+	return next;
+}	// convertNext
+
+/**********************************************************************
+**********************************************************************/
+void *convertWorker(void *arg)
+{
+	convertWorker_s_t *w = arg;
+	char *buf = malloc(convertChunkBytes + convertMaxLine + 2);	// + byte before chunk + '\0'
+	int c;
+
+	if (! buf)
+	{
+		printf("convertWorker malloc failed\n");
+		abort();
+	}
+
+	while ((c = convertNext(w)) >= 0)
+		convertChunk(w, &convert.chunk[c], buf);
+
+	free(buf);
+	return NULL;
+}	// convertWorker
+
+/**********************************************************************
+	Output of all chunks in time order: a heap of the chunks by the
+	time of their next record, equal times by chunk, i.e. input order.
+**********************************************************************/
+int convertBefore(int a, int b)
+{
+	convertChunk_s_t *ca = &convert.chunk[a], *cb = &convert.chunk[b];
+	time_t ta = ca->rec[ca->next].t, tb = cb->rec[cb->next].t;
+
+	return (ta < tb) || ((ta == tb) && (a < b));
+}	// convertBefore
+
+void convertSift(int *heap, int count, int i)
+{
+	for (;;)
+	{
+		int min = i, l = 2 * i + 1, r = 2 * i + 2, tmp;
+
+		if ((l < count) && convertBefore(heap[l], heap[min]))
+			min = l;
+		if ((r < count) && convertBefore(heap[r], heap[min]))
+			min = r;
+		if (min == i)
+			return;
+
+		tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}	// convertSift
+
+void convertMerge(void)
+{
+	int *heap = malloc((convert.countChunks + 1) * sizeof(*heap));
+	int count = 0;
+
+	if (! heap)
+	{
+		printf("convertMerge malloc failed\n");
+		abort();
+	}
+
+	for (int i = 0; i < convert.countChunks; i++)
+		if (convert.chunk[i].countRec)
+			heap[count++] = i;
+
+	for (int i = count / 2 - 1; i >= 0; i--)
+		convertSift(heap, count, i);
+
+	while (count)
+	{
+		convertChunk_s_t *c = &convert.chunk[heap[0]];
+		convertRec_s_t *r = &c->rec[c->next];
+		int second = (count > 2) && convertBefore(heap[2], heap[1]) ? heap[2] : heap[1];
+		size_t len = r->len;
+
+		// sorted input: write the run of records before any other chunk at once
+		for (c->next++; c->next < c->countRec; c->next++)
+		{
+			convertRec_s_t *n = &c->rec[c->next];
+
+			if ((n->off != r->off + len) || ((count > 1) && (! convertBefore(heap[0], second))))
+				break;
+			len += n->len;
+		}
+
+		fwrite(c->out + r->off, 1, len, stdout);
+
+		if (c->next == c->countRec)
+		{	// done, memory back early
+			free(c->out);
+			free(c->rec);
+			c->out = NULL;
+			c->rec = NULL;
+			heap[0] = heap[--count];
+		}
+		convertSift(heap, count, 0);
+	}
+
+	free(heap);
+}	// convertMerge
+
+/**********************************************************************
+	Convert comma separated files with threads workers, 0 if all lines
+	were converted.
+**********************************************************************/
+int convertFiles(char *files, int threads)
+{
+	int countFiles = 0;
+	long lines = 0, skipped = 0, stolen = 0;
+	char *file;
+	struct stat st;
+
+	for (file = strtok(files, ","); file; file = strtok(NULL, ","))
+	{
+		convert.fd = realloc(convert.fd, (countFiles + 1) * sizeof(*convert.fd));
+		convert.size = realloc(convert.size, (countFiles + 1) * sizeof(*convert.size));
+		if ((! convert.fd) || (! convert.size))
+		{
+			printf("convertFiles realloc failed\n");
+			abort();
+		}
+
+		if (((convert.fd[countFiles] = open(file, O_RDONLY)) < 0) || fstat(convert.fd[countFiles], &st))
+		{
+			printf("Open '%s' failed: %s\n", file, strerror(errno));
+			return(-1);
+		}
+		convert.size[countFiles] = st.st_size;
+
+		for (off_t start = 0; start < st.st_size; start += convertChunkBytes)
+		{
+			if (! (convert.chunk = realloc(convert.chunk, (convert.countChunks + 1) * sizeof(*convert.chunk))))
+			{
+				printf("convertFiles realloc failed\n");
+				abort();
+			}
+
+			convert.chunk[convert.countChunks++] = (convertChunk_s_t) {
+				.file = countFiles,
+				.start = start,
+				.end = (start + convertChunkBytes < st.st_size) ? start + convertChunkBytes : st.st_size
+			};
+		}
+		countFiles++;
+	}
+
+	if (threads > convert.countChunks)
+		threads = convert.countChunks ? convert.countChunks : 1;
+
+	if (! (convert.worker = calloc(threads, sizeof(*convert.worker))))
+	{
+		printf("convertFiles malloc failed\n");
+		abort();
+	}
+	convert.countWorkers = threads;
+
+	// neighbouring chunks to the same worker, it reads on where it stopped
+	for (int i = 0; i < threads; i++)
+	{
+		convertWorker_s_t *w = &convert.worker[i];
+
+		pthread_mutex_init(&w->lock, NULL);
+		w->head = (long) convert.countChunks * i / threads;
+		w->tail = (long) convert.countChunks * (i + 1) / threads;
+	}
+
+	for (int i = 1; i < threads; i++)
+	{
+		if ((errno = pthread_create(&convert.worker[i].thread, NULL, convertWorker, &convert.worker[i])))
+		{
+			printf("convertFiles pthread_create failed: %s\n", strerror(errno));
+			abort();
+		}
+	}
+	convertWorker(&convert.worker[0]);
+
+	for (int i = 0; i < threads; i++)
+	{
+		if (i)
+			pthread_join(convert.worker[i].thread, NULL);
+		pthread_mutex_destroy(&convert.worker[i].lock);
+
+		lines += convert.worker[i].lines;
+		skipped += convert.worker[i].skipped;
+		stolen += convert.worker[i].stolen;
+	}
+
+	for (int i = 0; i < countFiles; i++)
+		close(convert.fd[i]);
+
+	convertMerge();
+	fflush(stdout);
+
+	if (verbose > 0)
+		fprintf(stderr, "Convert: %d files, %ld lines, %d chunks, %d threads, %ld chunks stolen\n",
+			countFiles, lines, convert.countChunks, threads, stolen);
+
+	if (skipped)
+		fprintf(stderr, "Convert: %ld lines skipped, unknown register or not a cache line\n", skipped);
+
+	free(convert.worker);
+	free(convert.chunk);
+	free(convert.fd);
+	free(convert.size);
+
+	return(skipped ? -1 : 0);
+}	// convertFiles
+
+/**********************************************************************
+**********************************************************************/
+void dumpRegDef()
+{
+	for (int i = 0; regDef[i].regNr; i++ )
+	{
+		printf("0x%04X %4d %4d %4d\t%s\t%s\n",
+			regDef[i].regNr,
+			regDef[i].regLen,
+			regDef[i].regType,
+			regDef[i].regBase10,
+			regDef[i].unitStr,
 			regDef[i].descStr
 		);
 	}
 	exit(0);
 }	// dumpRegDef
 
-/**********************************************************************
-**********************************************************************/
-void usage(void)
-{
-	printf("usage: \n"
-		"	-h			this help\n"
-		"	-v [n] [-v ...]		verbose\n"
-		"	-V			version\n"
-		"	-i /dev/...		device (%s) - best a symlink to the real device via udev rule\n"
-		"	* -s 1200,8,E,1		not implemented yet - serial parameter (%d,%d,%c,%d)\n"
-		"	-sa nr			slave address (%d)\n"
-		"	-u			units of measure\n"
-		"	-t			title of register\n"
-		"	-setDate		set date on energy meter\n"
-		"	* -checkDate n		not implemented yet - check date on energy meter and report if off more than n sec\n"
-		"	-setBaudrate n		set baudrate to either 1200, 2400, 4800, 9600\n"
-		"	-l			list register configuration\n"
-		"	-r 0x1,0x2,0x3,...	dump register\n"
-		"	-bt n			byte timeout [ms]\n"
-		"	-rt n			response timeout [ms]\n"
-		"	-R n			report n\n"
-		"				1 Export Energy\n"
-		"				2 Current Volt and Current\n"
-		"				3 Power & cos phi\n"
-		"				* 4 Monthly reports - not implemented yet\n"
-		"	For write operations:\n"
-		"		Unlock meter - no lock symbol on LCD\n"
-		"		Increase timeout values\n"
-		"",
-		defaultSerialDevice,
-		defaultSerialBaud, defaultSerialDataBits, defaultSerialParity, defaultSerialStopBits,
-		defaultSlaveAddress
-		
-	);
-	
-	abort();
+/**********************************************************************
+**********************************************************************/
+void usage(void)
+{
+	printf("usage: \n"
+		"	-h			this help\n"
+		"	-v [n] [-v ...]		verbose\n"
+		"	-V			version\n"
+		"	-i /dev/...		device (%s) - best a symlink to the real device via udev rule\n"
+		"	-nb			non-blocking transport, -i /dev/a,/dev/b,... read concurrently\n"
+		"	-d n|demand		daemon, poll -r/-R every n sec or demand interval, aligned to wall clock\n"
+		"	-lowLatency [ms]	ASYNC_LOW_LATENCY and usb-serial latency timer (%d), reports\n"
+		"				read time before and after\n"
+		"	-rs485			kernel RS-485 direction control, RTS on while sending\n"
+		"	-model name|auto	meter model DRT-301M, DRT-301C, DRS-202M, DRS-202C: read only\n"
+		"				registers it has, auto asks every meter (Report Slave ID,\n"
+		"				else probe of Voltage L2)\n"
+		"	-batch [file]		run commands -r list, -R name, -setDate from stdin or\n"
+		"				file/FIFO on one connection, one result line each,\n"
+		"				reads waiting in the input are merged\n"
+		"	-convert file[,...]	decode archived -cache files with the current catalog\n"
+		"				(-regDef, -t, -u), one line per register in time order\n"
+		"	-threads n		-convert workers (one per cpu)\n"
+		"	-stagger n		offset between meters on one bus [ms] (estimated from read plan)\n"
+		"	-rollup list		with -d output min/max/avg/last of closed windows instead of\n"
+		"				samples, e.g. 1m,15m,1h, aligned to wall clock\n"
+		"	-demand [kW]		with -d rolling demand from Power Total over demand interval and\n"
+		"				slide time of the meter, peak of month, alarm above kW,\n"
+		"				compared hourly with max demand of the meter\n"
+		"	-deadband list		with -d output only values that moved more than their band\n"
+		"				since last output, [reg=]band[%%],..., e.g. 0x0010=2,0.5%%\n"
+		"	-heartbeat n		with -deadband output values silent for n sec (%d), 15m, 1h\n"
+		"	-cache file		with -d keep all registers read in file, else read -r/-R\n"
+		"				from it instead of the bus\n"
+		"	-readAhead [n]		with -cache refresh registers older than n sec (%d) in idle\n"
+		"				bus time before the next poll, stalest first\n"
+		"	-maxAge n		reading from -cache: fail if older than n sec, 15m, 1h\n"
+		"	-sink unix:path|tcp:host:port	with -d send samples and rollups as line protocol\n"
+		"				instead of stdout, batched, never blocks polling\n"
+		"	-spool file		keep lines the sink does not take, replayed in order\n"
+		"	-flush ms		max age of a sink batch (1000)\n"
+		"	-ts			prefix output with timestamp (always with -d)\n"
+		"	-derived		add derived metrics: average power, current imbalance,\n"
+		"				consumption per rate, power consistency\n"
+		"	* -s 1200,8,E,1		not implemented yet - serial parameter (%d,%d,%c,%d)\n"
+		"	-sa nr[,nr...]		slave address(es) (%d)\n"
+		"	-u			units of measure\n"
+		"	-t			title of register\n"
+		"	-setDate		set date on energy meter\n"
+		"	-checkDate n		check date on energy meter and report if off more than n sec\n"
+		"				with -setDate: set date only if off more than n sec, also with -d\n"
+		"	-broadcast n		with -setDate: set all meters of a bus with one broadcast,\n"
+		"				check clock of n meters afterwards (-checkDate limit)\n"
+		"	-setBaudrate n		set baudrate to either 1200, 2400, 4800, 9600\n"
+		"	-tariff hh:mm=t,...	compare tariff table (0xF700) with schedule, tariff 1-4\n"
+		"	-setTariff hh:mm=t,...	write registers of tariff table that differ from schedule\n"
+		"	-l			list register configuration\n"
+		"	-scan first,last	find readable registers with block reads (-mb),\n"
+		"				print register map for -regDef\n"
+		"	-regDef file		load register configuration from file (format as -l)\n"
+		"	-mb n			max registers per block read (%d)\n"
+		"	-r 0x1,0x2,0x3,...	dump register\n"
+		"	-bt n			byte timeout [ms]\n"
+		"	-rt n			response timeout [ms]\n"
+		"	-R name			report name, predefined or from config file\n"
+		"				1 Import Energy\n"
+		"				2 Current Volt and Current\n"
+		"				3 Power & cos phi\n"
+		"				4 Monthly reports\n"
+		"	-c file			config file, command line options override it,\n"
+		"				reloaded by -d on SIGHUP\n"
+		"				report <name> <lines|csv> <reg>,<reg>,...\n"
+		"				poll <report>		(-R)\n"
+		"				period <n>|demand	(-d)\n"
+		"				device <dev>[,<dev>...]	(-i, restart to change)\n"
+		"				slaves <nr>,<nr>,...	(-sa)\n"
+		"				stagger <ms>		(-stagger)\n"
+		"				rollup <window>,...	(-rollup)\n"
+		"				timeout <ms> [<ms>]	(-rt, -bt)\n"
+		"				output [title] [unit] [timestamp] [derived]\n"
+		"				sink unix:<path>|tcp:<host>:<port>	(-sink)\n"
+		"				spool <file>		(-spool)\n"
+		"				deadband <list> [<heartbeat>]	(-deadband, -heartbeat)\n"
+		"				demand [<alarm kW>]	(-demand)\n"
+		"	For write operations:\n"
+		"		Unlock meter - no lock symbol on LCD\n"
+		"		Increase timeout values\n"
+		"",
+		defaultSerialDevice,
+		defaultLatencyTimer,
+		defaultHeartbeat,
+		defaultReadAhead,
+		defaultSerialBaud, defaultSerialDataBits, defaultSerialParity, defaultSerialStopBits,
+		defaultSlaveAddress,
+		defaultMaxBlockLen
+		
+	);
+	
+	abort();
+
+}	// help
+
+
+/**********************************************************************
+**********************************************************************/
+int main(int argc, char *argv[])
+{
+	int rc;
+
+	if (argc == 1)
+		usage();
+
+	defaultRegDef();
+
+	for (int i = 1; i < argc; i++)
+	{	// Process commandline parameters
+		if (verbose > 3)
+			printf("Process commandline arg: argc=%d argv[%d]=%s.\n", argc, i, argv[i]);
+	
+		if (strcmp(argv[i], "-v") == 0)
+		{	// Verbose: -v [n]
+			optVerbose = 1;
+			verbose ++;
+
+//			printf("optVerbose: %d verbose: %d argc: %d\n", optVerbose, verbose, argc);
+
+			if (argc - i > 1)
+			{	// check for optional verbosity level
+				i++;
+//				printf("optVerbose: %d verbose: %d argc: %d argv[i+1]: %s\n", optVerbose, verbose, argc, argv[i]);
+
+				if (argv[i][0] != '-')
+				{	// next command line parameter could be an unsigned integer
+					char temp;
+					char *cp = NULL;
+					temp = (char) strtol(argv[i], &cp, 0);
+
+//					printf("optVerbose: %d verbose: %d temp: %d cp: %p, *cp: %s\n", optVerbose, verbose, temp, cp, cp);
+					
+					if (*cp == '\0')
+					{	// success! whole parameter converted by strtol
+						verbose = temp;
+					} else {
+						optVerbose = 0;
+					}
+
+//					printf("optVerbose: %d verbose: %d temp: %d cp: %s\n", optVerbose, verbose, temp, cp);
+					
+				} else {
+//					printf("verbose next arg starts with '-': %s.\n", argv[i]);
+					i--;
+				}
+			}
+			
+			if (! optVerbose)
+			{
+				printf("Error in -v, strange value: '%s'.\n", argv[i]);
+				optHelp++;
+				i = argc;
+				break;
+			}			
+		}
+		
+		else if (strcmp(argv[i], "-V") == 0)
+		{
+			printf("Compiled at: %s %s\n", compileDate, compileTime);
+			exit(0);
+		}
+
+		else if (strcmp(argv[i], "-u") == 0)
+			optUnit ++;
+
+		else if (strcmp(argv[i], "-t") == 0)
+			optTitle ++;
+
+		else if (strcmp(argv[i], "-l") == 0)
+			dumpRegDef();	// does not return
+
+		else if (strcmp(argv[i], "-regDef") == 0)
+		{	// Load register catalog
+			if ((argc - i > 1) && (loadRegDef(argv[i + 1]) == 0))
+			{
+				i++;
+			} else {
+				printf("-regDef missing or invalid file.\n");
+				optHelp++;
+				i = argc;
+				break;
+			}
+		}
+
+		else if (strcmp(argv[i], "-mb") == 0)
+		{	// Max registers per coalesced read
+			if (argc - i > 1)
+			{
+				i++;
+				maxBlockLen = strtol(argv[i], NULL, 0);
+			}
+
+			if ((maxBlockLen < 1) || (maxBlockLen > 125))
+			{
+				printf("-mb missing or invalid parameter.\n");
+				optHelp++;
+				i = argc;
+				break;
+			}
+		}
+
+		else if (strcmp(argv[i], "-setDate") == 0)
+			optSetDate ++;
+
+		else if (strcmp(argv[i], "-checkDate") == 0)
+		{	// Max clock drift [s]
+			if (argc - i > 1)
+			{
+				i++;
+				optCheckDate = strtol(argv[i], NULL, 0);
+			}
+
+			if (optCheckDate <= 0)
+			{
+				printf("-checkDate missing or invalid parameter.\n");
+				optHelp++;
+				i = argc;
+				break;
+			}
+		}
+
+		else if ((strcmp(argv[i], "-tariff") == 0) || (strcmp(argv[i], "-setTariff") == 0))
+		{	// Tariff schedule: -tariff hh:mm=t,...
+			if (argv[i][1] == 's')
+				optSetTariff++;
+
+			if (argc - i > 1)
+			{
+				i++;
+				optTariff = argv[i];
+			}
+
+			if (! optTariff)
+			{
+				printf("%s missing schedule.\n", argv[i]);
+				optHelp++;
+				i = argc;
+				break;
+			}
+		}
+
+		else if ((strcmp(argv[i], "-sink") == 0) || (strcmp(argv[i], "-spool") == 0))
+		{	// line protocol sink and its spool file
+			char **target = (argv[i][2] == 'i') ? &optSink : &optSpool;
+
+			if ((argc - i < 2) || ((target == &optSink)
+				&& strncmp(argv[i + 1], "unix:", 5) && strncmp(argv[i + 1], "tcp:", 4)))
+			{
+				printf("%s missing or invalid, use -sink unix:<path>|tcp:<host>:<port>, -spool <file>.\n", argv[i]);
+				optHelp++;
+				i = argc;
+				break;
+			}
+
+			*target = argv[++i];
+		}
+
+		else if (strcmp(argv[i], "-lowLatency") == 0)
+		{	// -lowLatency [ms]
+			optLowLatency = defaultLatencyTimer;
+
+			if ((argc - i > 1) && (argv[i + 1][0] != '-'))
+			{
+				i++;
+				optLowLatency = strtol(argv[i], NULL, 0);
+
+				if ((optLowLatency < 1) || (optLowLatency > 255))
+				{
+					printf("-lowLatency invalid latency timer, 1-255 ms.\n");
+					optHelp++;
+					i = argc;
+					break;
+				}
+			}
+		}
+
+		else if (strcmp(argv[i], "-rs485") == 0)
+			optRs485 = 1;
+
+		else if (strcmp(argv[i], "-model") == 0)
+		{	// -model name|auto
+			if ((argc - i < 2) || ((strcmp(argv[i + 1], "auto") != 0) && (! findModel(argv[i + 1]))))
+			{
+				printf("-model requires auto or one of");
+				for (int j = 0; models[j].name; j++)
+					printf(" %s", models[j].name);
+				printf(".\n");
+				optHelp++;
+				i = argc;
+				break;
+			}
+			cmdline.model = argv[++i];
+		}
+
+		else if (strcmp(argv[i], "-batch") == 0)
+		{	// -batch [file]
+			optBatch = 1;
+
+			if ((argc - i > 1) && (argv[i + 1][0] != '-'))
+				optBatchFile = argv[++i];
+		}
+
+		else if (strcmp(argv[i], "-convert") == 0)
+		{	// -convert file[,file...]
+			if ((argc - i < 2) || (argv[i + 1][0] == '-'))
+			{
+				printf("-convert missing file.\n");
+				optHelp++;
+				i = argc;
+				break;
+			}
+			optConvert = argv[++i];
+		}
+
+		else if (strcmp(argv[i], "-threads") == 0)
+		{	// -convert workers
+			if (argc - i > 1)
+			{
+				i++;
+				optThreads = strtol(argv[i], NULL, 0);
+			}
+
+			if (optThreads < 1)
+			{
+				printf("-threads missing or invalid number of threads.\n");
+				optHelp++;
+				i = argc;
+				break;
+			}
+		}
 
-}	// help
+		else if (strcmp(argv[i], "-flush") == 0)
+		{	// max age of sink batch [ms]
+			if (argc - i > 1)
+			{
+				i++;
+				optFlushUsec = strtol(argv[i], NULL, 0) * 1000;
+			}
 
+			if (optFlushUsec < 0)
+			{
+				printf("-flush missing or invalid max age.\n");
+				optHelp++;
+				i = argc;
+				break;
+			}
+		}
 
-/**********************************************************************
-**********************************************************************/
-int main(int argc, char *argv[])
-{
-	int rc;
+		else if (strcmp(argv[i], "-broadcast") == 0)
+		{	// -setDate by broadcast, verify n meters
+			if (argc - i > 1)
+			{
+				i++;
+				optBroadcast = strtol(argv[i], NULL, 0);
+			}
 
-	if (argc == 1)
-		usage();
+			if (optBroadcast < 0)
+			{
+				printf("-broadcast missing or invalid number of meters to verify.\n");
+				optHelp++;
+				i = argc;
+				break;
+			}
+		}
 
-	for (int i = 1; i < argc; i++)
-	{	// Process commandline parameters
-		if (verbose > 3)
-			printf("Process commandline arg: argc=%d argv[%d]=%s.\n", argc, i, argv[i]);
-	
-		if (strcmp(argv[i], "-v") == 0)
-		{	// Verbose: -v [n]
-			optVerbose = 1;
-			verbose ++;
+		else if (strcmp(argv[i], "-setBaudrate") == 0)
+		{
+			if (argc - i > 1)
+			{
+				i++;
+				optSetBaudrate = strtol(argv[i], NULL, 0);
+			}
+			
+			if (! optSetBaudrate)
+			{
+				optHelp++;
+				i = argc;
+				break;
+			}
+		}
+			
+		else if (strcmp(argv[i], "-h") == 0)
+			optHelp ++;
 
-//			printf("optVerbose: %d verbose: %d argc: %d\n", optVerbose, verbose, argc);
+		
+		else if (strcmp(argv[i], "-i") == 0)
+		{	// Set serial device
+			if (argc - i > 1)
+			{
+				i++;
+				optSerialDevice = argv[i];
+				
+				if (verbose > 3)
+					printf("optSerialDevice: %s\n", optSerialDevice);
+			}
+			else
+				printf("optSerialDevice missing device string.\n");
+			
+			if (! optSerialDevice)
+			{
+				optHelp++;
+				i = argc;
+			}
+		}
+
+		else if (strcmp(argv[i], "-s") == 0)
+		{	// Set serial parameters
+			printf("-s not implemented yet. Always using %d,%d,%c,%d.\n", defaultSerialBaud, defaultSerialDataBits, defaultSerialParity, defaultSerialStopBits); abort();
+			
+			if (argc - i > 2)
+			{
+				optSerialParms = argv[i + 1];
+				i++;
+			}
+			else
+			{
+				optHelp++;
+				i = argc;
+			}
+		}
+		
+		else if (strcmp(argv[i], "-sa") == 0)
+		{	// Set slave address(es)
+			optSlaveAddress++;
+			
+			if (argc - i > 1)
+			{
+				unsigned int *list = NULL;
+
+				i++;
+				countSlaves = parseRegList(argv[i], &list);
+				if (! (slaveList = realloc(slaveList, countSlaves + 1)))	// + 1: empty list is no failure
+				{
+					printf("-sa realloc failed\n");
+					abort();
+				}
+
+				for (int j = 0; j < countSlaves; j++)
+				{
+					if ((list[j] == 0) || (list[j] > 247))
+						countSlaves = 0;
+					else
+						slaveList[j] = list[j];
+				}
+				free(list);
+
+				if (! countSlaves)
+				{
+					printf("-sa strange parameter '%s'.\n", argv[i]);
+					optHelp++;
+					i = argc;
+				}
+				else
+					slaveAddress = slaveList[0];
+			} 
+			
+			else {
+				printf("-sa requires parameter for slave address.\n");
+				optHelp++;
+				i = argc;
+			}
+			
+//			if (verbose > 2) printf("Set Slave Address to %d.\n", )
+		}
 
+		else if (strcmp(argv[i], "-r") == 0)
+		{	// Dump registers
 			if (argc - i > 1)
-			{	// check for optional verbosity level
+			{
 				i++;
-//				printf("optVerbose: %d verbose: %d argc: %d argv[i+1]: %s\n", optVerbose, verbose, argc, argv[i]);
+				
+				if (verbose > 3)
+					printf("optRegsToDump: registers: %s\n", argv[i]);
 
-				if (argv[i][0] != '-')
-				{	// next command line parameter could be an unsigned integer
-					char temp;
-					char *cp = NULL;
-					temp = (char) strtol(argv[i], &cp, 0);
+				countRegs = parseRegList(argv[i], &optRegsToDump);
 
-//					printf("optVerbose: %d verbose: %d temp: %d cp: %p, *cp: %s\n", optVerbose, verbose, temp, cp, cp);
-					
-					if (*cp == '\0')
-					{	// success! whole parameter converted by strtol
-						verbose = temp;
-					} else {
-						optVerbose = 0;
-					}
+				// Dump reg array
+				if (verbose > 3)
+					for (int i = 0; i < countRegs; i++)
+						printf("optRegsToDump[%02d] = %5d, %04X\n", i, optRegsToDump[i], optRegsToDump[i]);
+				
+				if (verbose > 3)
+					printf("optRegsToDump: %d\n", countRegs);
 
-//					printf("optVerbose: %d verbose: %d temp: %d cp: %s\n", optVerbose, verbose, temp, cp);
-					
-				} else {
-//					printf("verbose next arg starts with '-': %s.\n", argv[i]);
-					i--;
+				if (countRegs <= 0)
+				{
+					printf("-r missing registers.\n");
+					optHelp++;
+					i = argc;
+					break;
 				}
 			}
+			else
+				printf("optRegsToDump missing device string.\n");
 			
-			if (! optVerbose)
+			if (! optRegsToDump)
 			{
-				printf("Error in -v, strange value: '%s'.\n", argv[i]);
 				optHelp++;
 				i = argc;
 				break;
-			}			
-		}
+			}
+		}	// -r
 		
-		else if (strcmp(argv[i], "-V") == 0)
-		{
-			printf("Compiled at: %s %s\n", compileDate, compileTime);
-			exit(0);
+		else if (strcmp(argv[i], "-R") == 0)
+		{	// Print predefined report
+			if (argc - i > 1)
+			{
+				i++;
+				optReport = argv[i];
+			}
+			
+			if (! optReport)
+			{
+				optHelp++;
+				i = argc;
+				break;
+			}
 		}
 
-		else if (strcmp(argv[i], "-u") == 0)
-			optUnit ++;
+		else if (strcmp(argv[i], "-nb") == 0)
+			optNonBlocking ++;
 
-		else if (strcmp(argv[i], "-t") == 0)
-			optTitle ++;
+		else if (strcmp(argv[i], "-ts") == 0)
+			optTimestamp ++;
 
-		else if (strcmp(argv[i], "-l") == 0)
-			dumpRegDef();	// does not return
+		else if (strcmp(argv[i], "-derived") == 0)
+			optDerived ++;
 
-		else if (strcmp(argv[i], "-setDate") == 0)
-			optSetDate ++;
+		else if (strcmp(argv[i], "-d") == 0)
+		{	// Daemon: -d period|demand
+			if (argc - i > 1)
+			{
+				i++;
+				if (strcmp(argv[i], "demand") == 0)
+					optDaemon = -1;
+				else
+				{
+					char *end;
 
-		else if (strcmp(argv[i], "-setBaudrate") == 0)
-		{
+					optDaemon = strtol(argv[i], &end, 0);
+					if (*end || (optDaemon < 0))
+						optDaemon = 0;
+				}
+			}
+
+			if (! optDaemon)
+			{
+				printf("-d missing or invalid period.\n");
+				optHelp++;
+				i = argc;
+				break;
+			}
+		}
+
+		else if (strcmp(argv[i], "-rollup") == 0)
+		{	// Rollup windows: -rollup 1m,15m,1h
 			if (argc - i > 1)
 			{
 				i++;
-				optSetBaudrate = strtol(argv[i], NULL, 0);
+				countRollups = parseDurationList(argv[i], &rollupWindows);
+			}
+
+			if (countRollups <= 0)
+			{
+				printf("-rollup missing or invalid windows.\n");
+				optHelp++;
+				i = argc;
+				break;
+			}
+		}
+
+		else if (strcmp(argv[i], "-cache") == 0)
+		{	// -cache file
+			if ((argc - i < 2) || (argv[i + 1][0] == '-'))
+			{
+				printf("-cache missing file.\n");
+				optHelp++;
+				i = argc;
+				break;
 			}
-			
-			if (! optSetBaudrate)
+			optCacheFile = argv[++i];
+		}
+
+		else if ((strcmp(argv[i], "-readAhead") == 0) || (strcmp(argv[i], "-maxAge") == 0))
+		{	// -readAhead [s], -maxAge s
+			int *target = (argv[i][1] == 'r') ? &optReadAhead : &optMaxAge;
+
+			*target = (target == &optReadAhead) ? defaultReadAhead : -1;
+
+			if ((argc - i > 1) && (argv[i + 1][0] != '-'))
+				*target = parseDuration(argv[++i]);
+
+			if (*target <= 0)
 			{
+				printf("%s missing or invalid duration.\n", argv[i]);
 				optHelp++;
 				i = argc;
 				break;
 			}
 		}
-			
-		else if (strcmp(argv[i], "-h") == 0)
-			optHelp ++;
 
-		
-		else if (strcmp(argv[i], "-i") == 0)
-		{	// Set serial device
+		else if (strcmp(argv[i], "-demand") == 0)
+		{	// rolling demand: -demand [alarm kW]
+			optDemand = 1;
+
+			if ((argc - i > 1) && (argv[i + 1][0] != '-'))
+			{
+				char *end;
+
+				optDemandAlarm = strtod(argv[++i], &end);
+				if (*end || (optDemandAlarm < 0))
+				{
+					printf("-demand invalid alarm limit [kW].\n");
+					optHelp++;
+					i = argc;
+					break;
+				}
+			}
+		}
+
+		else if (strcmp(argv[i], "-deadband") == 0)
+		{	// Report by exception: -deadband 0x0010=2,5%
 			if (argc - i > 1)
 			{
 				i++;
-				optSerialDevice = argv[i];
-				
-				if (verbose > 3)
-					printf("optSerialDevice: %s\n", optSerialDevice);
+				countDeadbands = parseDeadbands(argv[i], &deadbands);
 			}
-			else
-				printf("optSerialDevice missing device string.\n");
-			
-			if (! optSerialDevice)
+
+			if (countDeadbands <= 0)
 			{
+				printf("-deadband missing or invalid, use [reg=]band[%%],...\n");
 				optHelp++;
 				i = argc;
+				break;
 			}
 		}
 
-		else if (strcmp(argv[i], "-s") == 0)
-		{	// Set serial parameters
-			printf("-s not implemented yet. Always using %d,%d,%c,%d.\n", defaultSerialBaud, defaultSerialDataBits, defaultSerialParity, defaultSerialStopBits); abort();
-			
-			if (argc - i > 2)
+		else if (strcmp(argv[i], "-heartbeat") == 0)
+		{	// max silence with -deadband
+			if (argc - i > 1)
 			{
-				optSerialParms = argv[i + 1];
 				i++;
+				optHeartbeat = parseDuration(argv[i]);
 			}
-			else
+
+			if (optHeartbeat <= 0)
 			{
+				printf("-heartbeat missing or invalid duration.\n");
 				optHelp++;
 				i = argc;
+				break;
 			}
 		}
-		
-		else if (strcmp(argv[i], "-sa") == 0)
-		{	// Set slave address
-			// printf("-sa not implemented yet. Always using %d.\n", defaultSlaveAddress); abort();
-			optSlaveAddress++;
-			
-			char *cp = NULL;
-			
-			if (argc - i > 1)
+
+		else if (strcmp(argv[i], "-scan") == 0)
+		{	// Register map discovery: -scan first,last
+			unsigned int *list = NULL;
+
+			if ((argc - i > 1) && (parseRegList(argv[i + 1], &list) == 2)
+				&& (list[0] <= list[1]) && (list[1] <= 0xFFFF))
 			{
 				i++;
-				slaveAddress = (char) strtol(argv[i], &cp, 0);
-				
-				if ((*cp != '\0') || (slaveAddress == 0))
-				{
-					printf("-sa strange parameter '%s'.\n", argv[i]);
-					optHelp++;
-					i = argc;
-				}
-			} 
-			
-			else {
-				printf("-sa requires parameter for slave address.\n");
+				optScan++;
+				scanFirst = list[0];
+				scanLast = list[1];
+				free(list);
+			} else {
+				printf("-scan missing or invalid range.\n");
+				free(list);
 				optHelp++;
 				i = argc;
+				break;
 			}
-			
-//			if (verbose > 2) printf("Set Slave Address to %d.\n", )
 		}
 
-		else if (strcmp(argv[i], "-r") == 0)
-		{	// Dump registers
+		else if (strcmp(argv[i], "-stagger") == 0)
+		{	// Offset between meters on one bus
 			if (argc - i > 1)
 			{
-				#define DELIMITER ','
-				
 				i++;
-				
-				if (verbose > 3)
-					printf("optRegsToDump: registers: %s\n", argv[i]);
-
-//				countRegs = 0;
-				
-				char *cp = argv[i];
-				
-				cp = strtok(argv[i], ",");		// read man page for features and behaviour (",.." "...," ".,,,.")
-
-				if (cp)		// if /,+/ is given, cp is NULL
-				do {
-				
-					countRegs++;
-					long int li = strtol(cp, NULL, 0);	// convert ASCII dec, hex, oct to number
-				
-					if (verbose > 3)
-						printf("Token[%d]: %s %ld %ld\n", countRegs, cp, strlen(cp), li);
-
-					// extend reg array by one and add new value to end
-					unsigned int *ui_p = realloc(optRegsToDump, countRegs * sizeof(*optRegsToDump));
-					if (! ui_p)
-					{
-						printf("optRegsToDump realloc failed\n");
-						abort();
-					}
-					optRegsToDump = ui_p;
-					optRegsToDump[countRegs - 1] = (unsigned int) li;
-				
-				} while ((cp = strtok(NULL, ",")));
-
-				// Dump reg array
-				if (verbose > 3)
-					for (int i = 0; i < countRegs; i++)
-						printf("optRegsToDump[%02d] = %5d, %04X\n", i, optRegsToDump[i], optRegsToDump[i]);
-				
-				if (verbose > 3)
-					printf("optRegsToDump: %d\n", countRegs);
+				optStaggerUsec = strtol(argv[i], NULL, 0) * 1000L;
 			}
-			else
-				printf("optRegsToDump missing device string.\n");
-			
-			if (! optRegsToDump)
+
+			if (optStaggerUsec < 0)
 			{
+				printf("-stagger missing or invalid parameter.\n");
 				optHelp++;
 				i = argc;
 				break;
 			}
-		}	// -r
-		
-		else if (strcmp(argv[i], "-R") == 0)
-		{	// Print predefined report
+		}
+
+		else if (strcmp(argv[i], "-c") == 0)
+		{	// Config file
 			if (argc - i > 1)
 			{
 				i++;
-				optReport = strtol(argv[i], NULL, 0);
+				optConfigFile = argv[i];
 			}
-			
-			if (! optReport)
+
+			if (! optConfigFile)
 			{
+				printf("-c missing config file.\n");
 				optHelp++;
 				i = argc;
 				break;
@@ -819,11 +6949,72 @@ int main(int argc, char *argv[])
 
 	if (optHelp) usage();
 
-	if (! optSerialDevice)
+	buildRegIndex();
+
+	cmdline.device = optSerialDevice;
+	cmdline.report = optReport;
+	cmdline.period = optDaemon;
+	cmdline.staggerUsec = optStaggerUsec;
+	cmdline.slaves = countSlaves ? slaveList : NULL;
+	cmdline.countSlaves = countSlaves;
+	cmdline.rollupWindows = rollupWindows;
+	cmdline.countRollups = countRollups;
+	cmdline.responseTimeout = optResponseTimeout;
+	cmdline.byteTimeout = optByteTimeout;
+	cmdline.title = optTitle;
+	cmdline.unit = optUnit;
+	cmdline.timestamp = optTimestamp;
+	cmdline.derived = optDerived;
+	cmdline.sink = optSink;
+	cmdline.spool = optSpool;
+	cmdline.deadbands = deadbands;
+	cmdline.countDeadbands = countDeadbands;
+	cmdline.heartbeat = optHeartbeat;
+	cmdline.demand = optDemand;
+	cmdline.demandAlarm = optDemandAlarm;
+
+	if (optConfigFile && loadConfig(optConfigFile, &config))
+		exit(-1);
+
+	applyConfig(&config);
+
+	if (optConvert)
+	{	// offline, no device
+		if (optDaemon || optBatch || optCacheFile || optReport || optRegsToDump)
+		{
+			printf("-convert converts all registers of its files, not with -d, -batch, -cache, -r or -R.\n");
+			exit(-1);
+		}
+
+		if (! optThreads)
+			optThreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+		exit(convertFiles(optConvert, (optThreads > 0) ? optThreads : 1) ? -1 : 0);
+	}
+
+	readPlan_s_t *plan = NULL;
+
+	if (optReport)
+	{	// compile before opening the device, fail early
+		if (! (plan = findReport(&config.reports, optReport)))
+		{
+			printf("Unknown or invalid report '%s'.\n", optReport);
+			exit(-1);
+		}
+	}
+	else if (optRegsToDump)
+	{
+		if (! (plan = compileReadPlan("-r", LAYOUT_LINES, optRegsToDump, countRegs)))
+			exit(-1);
+	}
+
+	if (optSerialDevice)
+		serialDevice = strdup(optSerialDevice);
+	else if (config.device)
+		serialDevice = strdup(config.device);
+	else
 	{	// Set default serial device
 		serialDevice = strdup(defaultSerialDevice);		
-	} else {
-		serialDevice = strdup(optSerialDevice);
 	}
 
 	if (! optSerialParms)
@@ -838,6 +7029,99 @@ int main(int argc, char *argv[])
 				serialDevice, serialBaud, serialDataBits, serialParity, serialStopBits);
 	}
 	
+	if (optDaemon && (! plan))
+	{
+		printf("-d requires -r, -R or poll in config file.\n");
+		exit(-1);
+	}
+
+	if (countRollups && (! optDaemon))
+	{
+		printf("-rollup requires -d.\n");
+		exit(-1);
+	}
+
+	if (optReadAhead && ((! optDaemon) || (! optCacheFile)))
+	{
+		printf("-readAhead requires -d and -cache.\n");
+		exit(-1);
+	}
+
+	if (optCacheFile && (! optDaemon)
+		&& ((! plan) || optNonBlocking || optSetDate || optCheckDate || optSetBaudrate || optTariff || optScan))
+	{
+		printf("-cache without -d only reads -r/-R from cache, not with -nb.\n");
+		exit(-1);
+	}
+
+	if (optCacheFile)
+		setupCache();
+
+	if (optDemand && (! optDaemon))
+	{
+		printf("-demand requires -d.\n");
+		exit(-1);
+	}
+
+	if (countDeadbands && ((! optDaemon) || countRollups))
+	{
+		printf("-deadband requires -d, rollups are not filtered.\n");
+		exit(-1);
+	}
+
+	if ((optSink || optSpool) && (! optDaemon))
+	{
+		printf("-sink and -spool require -d.\n");
+		exit(-1);
+	}
+
+	if ((optBroadcast >= 0) && (! optSetDate))
+	{
+		printf("-broadcast requires -setDate.\n");
+		exit(-1);
+	}
+
+	if (optSpool && (! optSink))
+	{
+		printf("-spool requires -sink.\n");
+		exit(-1);
+	}
+
+	if (optBatch && (optDaemon || optCacheFile || plan))
+	{
+		printf("-batch reads -r/-R from its input, not with -d or -cache.\n");
+		exit(-1);
+	}
+
+	if (optNonBlocking)
+	{	// all devices of -i concurrently over non-blocking transport
+		if ((! plan) && (! optDaemon) && (! optBatch) && (! optCheckDate) && (! optSetDate)
+			&& (! optSetBaudrate) && (! optTariff) && (! optScan))
+		{
+			printf("-nb: nothing to do, use -r, -R, -d, -checkDate, -setDate, -setBaudrate, -tariff, -scan or -batch.\n");
+			exit(-1);
+		}
+
+		for (char *dev = strtok(serialDevice, ","); dev; dev = strtok(NULL, ","))
+		{
+			rtuBus_s_t *bus = rtuOpen(dev, serialBaud, serialParity, serialDataBits, serialStopBits);
+
+			if (! bus)
+				exit(-1);
+
+			if (! (buses = realloc(buses, (countBuses + 1) * sizeof(*buses))))
+			{
+				printf("buses realloc failed\n");
+				abort();
+			}
+			buses[countBuses++] = bus;
+		}
+	}
+
+	syncMeters();
+
+	if ((! optNonBlocking) && (optDaemon || (! optCacheFile)))
+	{	// reading from cache leaves the bus to the daemon
 	#if 1	// modbus related stuff
 	// Create modbus rtu context
 //	ctx = modbus_new_rtu("/dev/ttyUSB0", 1200, 'E', 8, 1);
@@ -858,6 +7142,12 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "MODBUS connect failed: %s\n", modbus_strerror(errno));
 		abort();
 	}
+	if (ioctl(modbus_get_socket(ctx), TIOCEXCL) < 0)
+	{	// as mbc_open() does for -nb
+		fprintf(stderr, "Lock %s failed: %s\n", serialDevice, strerror(errno));
+		exit(-1);
+	}
+	mbc_attach(&ctxBus, modbus_get_socket(ctx), serialBaud, serialParity, serialDataBits, serialStopBits);
 
 	// Select slave to talk to
 	if (verbose > 2) printf("Set slave address to %d.\n", slaveAddress);
@@ -896,84 +7186,103 @@ int main(int argc, char *argv[])
 		printf("MODBUS Response Timeout: %lus %luus\n", responseTimeout.tv_sec, responseTimeout.tv_usec);
 	}
 	#endif
-	
-	if (optReport)
+	}	// ! optNonBlocking
+
+	if (optLowLatency || optRs485)
+		lowLatencyAll();
+
+	if (optModel)
+		setupModels();
+
+	if (optBatch)
+		exit(runBatch(optBatchFile) ? -1 : 0);
+
+	if (optDaemon)
 	{
-		switch (optReport)
+		runDaemon(plan);
+
+		if (ctx)
 		{
-		case 1:
-			// kWh
-			dumpRegister(0x0160);
-			break;
-		case 2:
-			// Voltage
-			dumpRegister(0x0010);
-			dumpRegister(0x0012);
-			dumpRegister(0x0014);
-			// Current
-			dumpRegister(0x0050);
-			dumpRegister(0x0052);
-			dumpRegister(0x0054);
-			dumpRegister(0x0056);
-			break;
-		case 3:
-			// Power
-			dumpRegister(0x0090);
-			dumpRegister(0x0092);
-			dumpRegister(0x0094);
-			dumpRegister(0x0096);
-			// Apparent Power
-			dumpRegister(0x00D0);
-			dumpRegister(0x00D2);
-			dumpRegister(0x00D4);
-			dumpRegister(0x00D6);
-			// Reactive Power
-			dumpRegister(0x0110);
-			dumpRegister(0x0112);
-			dumpRegister(0x0114);
-			dumpRegister(0x0116);
-			// Power Factor
-			dumpRegister(0x0150);
-			dumpRegister(0x0152);
-			dumpRegister(0x0154);
-			dumpRegister(0x0156);
-			break;
-		case 4:
-			dumpRegister(0xF111);
-			break;
-		default:
-			break;
+			modbus_close(ctx);
+			modbus_free(ctx);
 		}
-
 		exit(0);
-	}	// optReport
+	}
+
+	if (optScan)
+		exit(scanRegisters(meters, scanFirst, scanLast) ? -1 : 0);
+
+	if (optTariff)
+	{	// with -setTariff write differing registers only
+		int rc = tariffAll(optTariff, optSetTariff);
+
+		exit((rc < 0) ? -1 : (rc && ! optSetTariff) ? 1 : 0);
+	}
+
+	if (optSetDate && (optBroadcast >= 0))
+		exit(broadcastDate(optBroadcast) ? -1 : 0);
+
+	if (optCheckDate)
+	{	// report drift, -setDate only if off
+		int off = checkDateAll();
+
+		if (! plan)
+			exit(off ? 1 : 0);
+	}
+
+	if (plan)
+	{	// -R or -r on all meters
+		meter_s_t **due = malloc(countMeters * sizeof(*due));
+		derivedPlan_s_t dp;
+		int i = 0;
+
+		if (! (plan = preparePlan(plan)))
+			exit(-1);
+		setupDerivedPlan(plan, &dp);
+
+		for (meter_s_t *m = meters; m; m = m->next)
+			due[i++] = m;
+
+		int failed = optCacheFile ? cachePlan(plan, due, countMeters) : pollMeters(plan, due, countMeters);
+
+		for (i = 0; i < countMeters; i++)
+		{
+			if (due[i]->failed)
+				continue;
+
+			double derived[countDerived];
+
+			if (optDerived)
+				computeDerived(due[i], plan, &dp, meterBuf(due[i]), derived);
+
+			outputReadPlan(plan, meterBuf(due[i]), samplePrefix(due[i]), NULL, due[i]->present, optDerived ? derived : NULL);
+		}
+
+		exit(failed ? -1 : 0);
+	}
+	
 	
 	if (optSetDate)
-	{	// Set current date on device
-		int rc = setDate(ctx, NULL);
-		exit(rc);
+	{	// Set current date on devices
+		for (meter_s_t *m = meters; m; m = m->next)
+			setDate(m, NULL);
+		exit(flushWrites() ? -1 : 0);
 	}
 
 	if (optSetBaudrate)
-	{	// Set new baudrate on device
-		int rc = setBaudrate(ctx, optSetBaudrate);
-		exit(rc);
+	{	// Set new baudrate on devices
+		for (meter_s_t *m = meters; m; m = m->next)
+			if (setBaudrate(m, optSetBaudrate))
+				exit(-1);
+		exit(flushWrites() ? -1 : 0);
 	}
 	
-	if (optRegsToDump)
-	{
-		int rc = 0;
-	
-		for (int i = 0; i < countRegs; i++)
-		{
-			rc = dumpRegister(optRegsToDump[i]);
-//			if (rc) break;
-		}
-		exit(rc);
-	}	// optRegsToDump
 
-	modbus_close(ctx);
-	modbus_free(ctx);
+	if (ctx)
+	{
+		modbus_close(ctx);
+		modbus_free(ctx);
+	}
 
 	exit(0);
 }	// main	
@@ -1130,53 +7439,7 @@ int main(int argc, char *argv[])
 	}
 #endif
 
-#if 0	// try to read all registers
-	
-	for (unsigned int i = 0; i < 0xFFF0; i++)
-	{
-		read32(i);
-	}
-#endif
-
-#if 0 // search for valid length of a register response
-
-	// search for valid length of a register response
-
-	for (int i = 0; i <= 0x100; i++)
-	{
-	
-		uint8_t hi = 0xF6;
-		uint8_t lo = 0x00;
-		uint8_t len = i;
-	
-		printf("Test 0xF600:%02X %3d\n", i, i);
-	
-		uint8_t raw_req[] = { 0x01, 0x03, 0x00, 0x00 , 0x00, 0x00};
-	
-		raw_req[2] = hi;
-		raw_req[3] = lo;
-		raw_req[5] = len;
-	
-		uint8_t rsp[MODBUS_TCP_MAX_ADU_LENGTH];
-
-		int req_length = modbus_send_raw_request(ctx, raw_req, sizeof(raw_req));
-		int res_length = modbus_receive_confirmation(ctx, rsp);
-	
-		printf("REQ Length: %d RES Length: %d\n", req_length, res_length);
-
-		if (res_length > 0)
-		{
-			for (int i = 0; i < res_length; i++)
-			{
-				printf("%02X ", rsp[i]);
-				abort();
-			}
-			printf("\n");
-		}
-	}
 
-	abort();
-#endif
 
 
 